@@ -0,0 +1,14 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libmididrone_feed
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Shared memory feed of the mididrone driver channel states.
+LOCAL_SRC_FILES := \
+	feed.c
+
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_EXPORT_LDLIBS := -lrt
+
+include $(BUILD_STATIC_LIBRARY)
@@ -0,0 +1,230 @@
+#include "feed.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Consistent copy attempts before a reader gives up */
+#define FEED_READ_RETRIES 100000
+#define FEED_WORDS (sizeof(struct feed_snapshot) / sizeof(uint32_t))
+
+/* The snapshot is copied in and out a 32-bit word at a time with relaxed
+ * atomic accesses: readers racing with the writer get torn data, never
+ * undefined behaviour, and tell it from the sequence. */
+struct feed_segment {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t snapshot_size;
+	uint32_t writer_pid;
+	uint32_t seq;
+	uint32_t reserved;
+	uint32_t words[FEED_WORDS];
+};
+
+struct feed_writer {
+	char *name;
+	struct feed_segment *segment;
+	struct feed_snapshot snapshot;
+	uint32_t seq;
+};
+
+struct feed_reader {
+	const struct feed_segment *segment;
+	uint32_t last_seq;
+};
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct feed_writer *feed_writer_new(const char *name, unsigned int channels)
+{
+	struct feed_writer *writer;
+	void *addr;
+	int fd;
+
+	if (channels > FEED_MAX_CHANNELS) {
+		printf("Feed: %u channels, at most %d are published\n",
+				channels, FEED_MAX_CHANNELS);
+		channels = FEED_MAX_CHANNELS;
+	}
+	writer = calloc(1, sizeof(*writer));
+	if (!writer)
+		return NULL;
+	writer->name = strdup(name);
+	if (!writer->name)
+		goto error;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		printf("Cannot open shared memory %s: %s\n", name,
+				strerror(errno));
+		goto error;
+	}
+	if (ftruncate(fd, sizeof(struct feed_segment)) == -1) {
+		printf("Cannot size shared memory %s: %s\n", name,
+				strerror(errno));
+		close(fd);
+		goto error_unlink;
+	}
+	addr = mmap(NULL, sizeof(struct feed_segment), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		printf("Cannot map shared memory %s: %s\n", name,
+				strerror(errno));
+		goto error_unlink;
+	}
+
+	/* Touch the whole segment now, not on the first publish. Readers
+	 * only look at a segment once its magic is there. */
+	writer->segment = addr;
+	__atomic_store_n(&writer->segment->magic, 0, __ATOMIC_RELAXED);
+	memset(writer->segment->words, 0, sizeof(writer->segment->words));
+	writer->segment->version = FEED_VERSION;
+	writer->segment->snapshot_size = sizeof(struct feed_snapshot);
+	writer->segment->writer_pid = (uint32_t)getpid();
+	writer->segment->seq = 0;
+	__atomic_store_n(&writer->segment->magic, FEED_MAGIC,
+			__ATOMIC_RELEASE);
+
+	writer->snapshot.channels = channels;
+	for (unsigned int i = 0; i < FEED_MAX_CHANNELS; i++)
+		writer->snapshot.chans[i].lchannel = -1;
+	return writer;
+
+error_unlink:
+	shm_unlink(name);
+error:
+	free(writer->name);
+	free(writer);
+	return NULL;
+}
+
+void feed_writer_destroy(struct feed_writer *writer)
+{
+	if (!writer)
+		return;
+	munmap(writer->segment, sizeof(struct feed_segment));
+	shm_unlink(writer->name);
+	free(writer->name);
+	free(writer);
+}
+
+struct feed_snapshot *feed_writer_snapshot(struct feed_writer *writer)
+{
+	return &writer->snapshot;
+}
+
+void feed_writer_publish(struct feed_writer *writer)
+{
+	struct feed_segment *segment = writer->segment;
+	const uint32_t *words;
+	unsigned int i;
+
+	writer->snapshot.updates++;
+	writer->snapshot.date = monotonic_ns();
+	words = (const uint32_t *)&writer->snapshot;
+
+	/* Odd while updating, and the words stored after it */
+	__atomic_store_n(&segment->seq, writer->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < FEED_WORDS; i++)
+		__atomic_store_n(&segment->words[i], words[i],
+				__ATOMIC_RELAXED);
+	writer->seq += 2;
+	__atomic_store_n(&segment->seq, writer->seq, __ATOMIC_RELEASE);
+}
+
+struct feed_reader *feed_reader_new(const char *name)
+{
+	struct feed_reader *reader;
+	const struct feed_segment *segment;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1) {
+		printf("Cannot open shared memory %s: %s\n", name,
+				strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 ||
+	    st.st_size < (off_t)sizeof(struct feed_segment)) {
+		printf("%s is not a channel state feed\n", name);
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, sizeof(struct feed_segment), PROT_READ, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		printf("Cannot map shared memory %s: %s\n", name,
+				strerror(errno));
+		return NULL;
+	}
+	segment = addr;
+	if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != FEED_MAGIC ||
+	    segment->version != FEED_VERSION ||
+	    segment->snapshot_size != sizeof(struct feed_snapshot)) {
+		printf("%s: not a channel state feed, or unsupported "
+				"version\n", name);
+		munmap(addr, sizeof(struct feed_segment));
+		return NULL;
+	}
+
+	reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		munmap(addr, sizeof(struct feed_segment));
+		return NULL;
+	}
+	reader->segment = segment;
+	/* Never a stable sequence: the first read is an update */
+	reader->last_seq = 1;
+	return reader;
+}
+
+void feed_reader_destroy(struct feed_reader *reader)
+{
+	if (!reader)
+		return;
+	munmap((void *)reader->segment, sizeof(struct feed_segment));
+	free(reader);
+}
+
+int feed_reader_read(struct feed_reader *reader,
+		struct feed_snapshot *snapshot)
+{
+	const struct feed_segment *segment = reader->segment;
+	uint32_t *words = (uint32_t *)snapshot;
+	uint32_t seq, check;
+	unsigned int i, tries;
+
+	for (tries = 0; tries < FEED_READ_RETRIES; tries++) {
+		seq = __atomic_load_n(&segment->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		for (i = 0; i < FEED_WORDS; i++)
+			words[i] = __atomic_load_n(&segment->words[i],
+					__ATOMIC_RELAXED);
+		/* The copy completes before the sequence is checked again */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		check = __atomic_load_n(&segment->seq, __ATOMIC_RELAXED);
+		if (check != seq)
+			continue;
+		if (seq == reader->last_seq)
+			return 0;
+		reader->last_seq = seq;
+		return 1;
+	}
+	return -1;
+}
@@ -0,0 +1,62 @@
+#ifndef MIDIDRONE_FEED_H_INCLUDED
+#define MIDIDRONE_FEED_H_INCLUDED
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Channel state feed: a POSIX shared memory segment where a musician
+ * publishes the state of its driver channels and the song time, for
+ * light shows, visualizers and other local observers.
+ * The segment is a seqlock: the sequence is odd while the writer updates
+ * the snapshot, and bumped again when done. Readers copy the snapshot and
+ * retry when the sequence moved meanwhile. Neither side ever waits for
+ * the other, nor makes a system call once the segment is mapped. */
+#define FEED_MAGIC 0x4d444644 /* "MDFD" */
+#define FEED_VERSION 1
+#define FEED_MAX_CHANNELS 16
+#define FEED_DEFAULT_NAME "/mididrone_feed"
+
+struct feed_channel {
+	uint32_t busy;
+	int32_t lchannel;  /* Logical channel, or -1 */
+	int32_t freq;
+	int32_t ratio;
+	int64_t stoptime;  /* Song date, ns */
+};
+
+struct feed_snapshot {
+	int64_t song_time; /* ns, as of the last driver call */
+	int64_t date;      /* CLOCK_MONOTONIC date of the update, ns */
+	uint32_t updates;  /* Snapshots published so far */
+	uint32_t channels;
+	struct feed_channel chans[FEED_MAX_CHANNELS];
+};
+
+struct feed_writer;
+struct feed_reader;
+
+/* Create (or take over) the segment name, as for shm_open() */
+struct feed_writer *feed_writer_new(const char *name, unsigned int channels);
+/* Unmaps and removes the segment */
+void feed_writer_destroy(struct feed_writer *writer);
+/* Snapshot to fill in before publishing it. Its updates and date fields
+ * are set on publish. */
+struct feed_snapshot *feed_writer_snapshot(struct feed_writer *writer);
+void feed_writer_publish(struct feed_writer *writer);
+
+struct feed_reader *feed_reader_new(const char *name);
+void feed_reader_destroy(struct feed_reader *reader);
+/* Copy a consistent snapshot. Returns 1 when it was updated since the
+ * last read, 0 when it was not, and -1 when no consistent copy could be
+ * made (writer stuck in an update). */
+int feed_reader_read(struct feed_reader *reader,
+		struct feed_snapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,10 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libmididrone_proto
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Wire format of the packets exchanged by the mididrone conductor and musicians.
+
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
+
+include $(BUILD_CUSTOM)
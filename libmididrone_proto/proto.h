@@ -0,0 +1,41 @@
+#ifndef MIDIDRONE_PROTO_H_INCLUDED
+#define MIDIDRONE_PROTO_H_INCLUDED
+
+#include <stdint.h>
+
+/* Packets exchanged by the conductor and the musicians over UDP. All the
+ * fields are in network byte order.
+ * Timestamp packets only carry a uint32_t, the conductor time in seconds,
+ * so musicians tell them apart from the other packets by size. Timestamp
+ * 0 is the Go, unless a start was announced. */
+
+/* Start announcement, sent repeatedly before a scheduled start. Both dates
+ * are read on the conductor's CLOCK_MONOTONIC. */
+#define START_MAGIC 0x4d445354 /* "MDST" */
+struct start_msg {
+	uint32_t magic;
+	uint32_t now_sec;
+	uint32_t now_nsec;
+	uint32_t start_sec;
+	uint32_t start_nsec;
+} __attribute__((packed));
+
+/* Status report, sent back by musicians every second or so, to the
+ * address the conductor packets come from. */
+#define STATUS_MAGIC 0x4d445352 /* "MDSR" */
+#define STATUS_PLAYING 1
+#define STATUS_ENDED 2
+struct status_msg {
+	uint32_t magic;
+	uint32_t id;          /* Tells apart the musicians of a host */
+	uint32_t seq;
+	uint32_t state;
+	int32_t position_ms;  /* Song position */
+	int32_t offset_us;    /* Clock correction applied */
+	uint32_t late_p99_us; /* Wakeup lateness over the last period */
+	uint32_t events;
+	uint32_t dropped;     /* Notes dropped late or refused */
+	uint32_t errors;      /* Driver errors */
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,13 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libmididrone_render
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Offline rendering of the drone PWM channels to a WAV file.
+LOCAL_SRC_FILES := \
+	render.c
+
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_CFLAGS := -std=gnu99 -O3
+
+include $(BUILD_STATIC_LIBRARY)
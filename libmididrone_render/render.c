@@ -0,0 +1,350 @@
+#include "render.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Frames synthesized at once, a multiple of the vector width */
+#define RENDER_BLOCK 256
+/* Frames buffered between two writes to the file */
+#define RENDER_BUFFER 32768
+#define WAV_HEADER_SIZE 44
+
+/* GCC generic vectors, lowered to SSE2 or NEON when available and to
+ * scalar code otherwise. */
+#define VEC_LEN 4
+typedef int32_t v4si __attribute__((vector_size(VEC_LEN * 4)));
+typedef uint32_t v4su __attribute__((vector_size(VEC_LEN * 4)));
+
+/* Phases are 32-bit fixed point fractions of a period, wrapping around
+ * at the end of each period. */
+struct render_channel {
+	uint32_t phase;
+	uint32_t inc;       // Phase step per frame
+	uint32_t threshold; // High while phase < threshold
+	int32_t high;
+	int32_t low;
+	int active;
+};
+
+struct render {
+	int fd; // -1 when rendering into memory
+	unsigned int rate;
+	unsigned int num_channels;
+	int32_t amplitude;
+	struct render_channel *channels;
+	uint64_t frames;
+	int16_t *buffer;
+	size_t count;
+	/* Memory renders */
+	int16_t *samples;
+	uint64_t capacity;
+	uint64_t stored;
+	int error;
+	v4si mix[RENDER_BLOCK / VEC_LEN];
+};
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *ptr = data;
+	while (len > 0) {
+		ssize_t res = write(fd, ptr, len);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ptr += res;
+		len -= (size_t)res;
+	}
+	return 0;
+}
+
+static void put_le16(uint8_t *p, uint16_t val)
+{
+	p[0] = (uint8_t)val;
+	p[1] = (uint8_t)(val >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t val)
+{
+	put_le16(p, (uint16_t)val);
+	put_le16(p + 2, (uint16_t)(val >> 16));
+}
+
+/* Canonical 44-byte PCM header, sizes are patched once known */
+static void wav_header(uint8_t *header, unsigned int rate,
+		unsigned int channels, uint64_t frames)
+{
+	uint32_t data_size = (uint32_t)(frames * channels * 2);
+
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, 36 + data_size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	put_le16(header + 20, 1); // PCM
+	put_le16(header + 22, (uint16_t)channels);
+	put_le32(header + 24, rate);
+	put_le32(header + 28, rate * channels * 2);
+	put_le16(header + 32, (uint16_t)(channels * 2));
+	put_le16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, data_size);
+}
+
+static void store(struct render *render)
+{
+	if (render->stored + render->count > render->capacity) {
+		uint64_t capacity = render->capacity ? render->capacity * 2 :
+			RENDER_BUFFER;
+		int16_t *samples;
+		while (capacity < render->stored + render->count)
+			capacity *= 2;
+		samples = realloc(render->samples, capacity * sizeof(int16_t));
+		if (!samples) {
+			if (!render->error)
+				printf("Out of memory for %llu frames\n",
+						(unsigned long long)capacity);
+			render->error = 1;
+			return;
+		}
+		render->samples = samples;
+		render->capacity = capacity;
+	}
+	memcpy(render->samples + render->stored, render->buffer,
+			render->count * sizeof(int16_t));
+	render->stored += render->count;
+}
+
+static void flush(struct render *render)
+{
+	if (render->count == 0)
+		return;
+	if (render->fd == -1)
+		store(render);
+	else if (write_all(render->fd, render->buffer,
+				render->count * sizeof(int16_t))) {
+		if (!render->error)
+			printf("Failed to write WAV file: %s\n",
+					strerror(errno));
+		render->error = 1;
+	}
+	render->count = 0;
+}
+
+struct render *render_new_memory(unsigned int rate, unsigned int channels)
+{
+	struct render *render;
+
+	if (rate == 0 || channels == 0)
+		return NULL;
+	render = calloc(1, sizeof(*render));
+	if (!render)
+		return NULL;
+	render->fd = -1;
+	render->rate = rate;
+	render->num_channels = channels;
+	/* The channels can never clip, even all high at once */
+	render->amplitude = INT16_MAX / (int32_t)channels;
+	render->channels = calloc(channels, sizeof(struct render_channel));
+	render->buffer = calloc(RENDER_BUFFER, sizeof(int16_t));
+	if (!render->channels || !render->buffer) {
+		free(render->buffer);
+		free(render->channels);
+		free(render);
+		return NULL;
+	}
+	return render;
+}
+
+struct render *render_new(const char *path, unsigned int rate,
+		unsigned int channels)
+{
+	struct render *render;
+	uint8_t header[WAV_HEADER_SIZE];
+
+	render = render_new_memory(rate, channels);
+	if (!render)
+		return NULL;
+
+	render->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	if (render->fd == -1) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	wav_header(header, rate, 1, 0);
+	if (write_all(render->fd, header, sizeof(header))) {
+		printf("Failed to write WAV file: %s\n", strerror(errno));
+		close(render->fd);
+		goto error;
+	}
+	return render;
+
+error:
+	free(render->buffer);
+	free(render->channels);
+	free(render);
+	return NULL;
+}
+
+int render_destroy(struct render *render)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+	int res;
+
+	if (!render)
+		return 0;
+	flush(render);
+	if (render->fd != -1) {
+		wav_header(header, render->rate, 1, render->frames);
+		if (pwrite(render->fd, header, sizeof(header), 0) !=
+				(ssize_t)sizeof(header)) {
+			printf("Failed to write WAV header: %s\n",
+					strerror(errno));
+			render->error = 1;
+		}
+		close(render->fd);
+	}
+	res = render->error ? -1 : 0;
+	free(render->samples);
+	free(render->buffer);
+	free(render->channels);
+	free(render);
+	return res;
+}
+
+void render_set(struct render *render, unsigned int channel, int freq,
+		int ratio)
+{
+	struct render_channel *chan;
+	uint64_t threshold;
+
+	if (channel >= render->num_channels)
+		return;
+	chan = &render->channels[channel];
+	if (freq <= 0 || ratio <= 0 || (unsigned int)freq >= render->rate / 2) {
+		chan->active = 0;
+		return;
+	}
+	if (ratio > RENDER_RATIO_MAX)
+		ratio = RENDER_RATIO_MAX;
+
+	/* A note starts on a rising edge */
+	if (!chan->active)
+		chan->phase = 0;
+	chan->inc = (uint32_t)(((uint64_t)freq << 32) / render->rate);
+	threshold = ((uint64_t)ratio << 32) / RENDER_RATIO_MAX;
+	chan->threshold = threshold > UINT32_MAX ? UINT32_MAX :
+		(uint32_t)threshold;
+	/* Remove the DC component: the wave averages to 0 over a period */
+	chan->high = (int32_t)((int64_t)render->amplitude *
+			(RENDER_RATIO_MAX - ratio) / RENDER_RATIO_MAX);
+	chan->low = chan->high - render->amplitude;
+	chan->active = 1;
+}
+
+/* Add one channel over n frames of the mix, VEC_LEN frames at a time */
+static void render_channel(struct render_channel *chan, v4si *mix,
+		unsigned int n)
+{
+	v4su phase = { chan->phase, chan->phase + chan->inc,
+		chan->phase + 2 * chan->inc, chan->phase + 3 * chan->inc };
+	const uint32_t step4 = VEC_LEN * chan->inc;
+	const v4su step = { step4, step4, step4, step4 };
+	const v4su threshold = { chan->threshold, chan->threshold,
+		chan->threshold, chan->threshold };
+	const v4si high = { chan->high, chan->high, chan->high, chan->high };
+	const v4si low = { chan->low, chan->low, chan->low, chan->low };
+	unsigned int i;
+
+	for (i = 0; i < (n + VEC_LEN - 1) / VEC_LEN; i++) {
+		/* All ones where high, zero elsewhere */
+		v4si mask = (v4si)(phase < threshold);
+		mix[i] += (mask & high) | (~mask & low);
+		phase += step;
+	}
+	chan->phase += n * chan->inc;
+}
+
+static void render_block(struct render *render, unsigned int n)
+{
+	const int32_t *mix = (const int32_t *)render->mix;
+	unsigned int i;
+
+	memset(render->mix, 0, sizeof(render->mix));
+	for (i = 0; i < render->num_channels; i++) {
+		if (render->channels[i].active)
+			render_channel(&render->channels[i], render->mix, n);
+	}
+
+	if (render->count + n > RENDER_BUFFER)
+		flush(render);
+	/* WAV samples are little-endian, as both our targets are */
+	for (i = 0; i < n; i++)
+		render->buffer[render->count + i] = (int16_t)mix[i];
+	render->count += n;
+	render->frames += n;
+}
+
+void render_advance(struct render *render, int64_t date)
+{
+	uint64_t target;
+
+	if (date <= 0)
+		return;
+	target = (uint64_t)date * render->rate / 1000000000ULL;
+	while (render->frames < target) {
+		uint64_t n = target - render->frames;
+		render_block(render, n > RENDER_BLOCK ? RENDER_BLOCK :
+				(unsigned int)n);
+	}
+}
+
+uint64_t render_frames(const struct render *render)
+{
+	return render->frames;
+}
+
+unsigned int render_rate(const struct render *render)
+{
+	return render->rate;
+}
+
+int16_t *render_take_samples(struct render *render, uint64_t *frames)
+{
+	int16_t *samples;
+
+	flush(render);
+	samples = render->samples;
+	*frames = render->stored;
+	render->samples = NULL;
+	render->capacity = 0;
+	render->stored = 0;
+	return samples;
+}
+
+int render_wav_write(const char *path, unsigned int rate,
+		unsigned int channels, const int16_t *samples,
+		uint64_t frames)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+	int fd, res;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	wav_header(header, rate, channels, frames);
+	res = write_all(fd, header, sizeof(header));
+	if (!res)
+		res = write_all(fd, samples,
+				(size_t)(frames * channels * sizeof(int16_t)));
+	if (res)
+		printf("Failed to write %s: %s\n", path, strerror(errno));
+	close(fd);
+	return res;
+}
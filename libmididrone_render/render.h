@@ -0,0 +1,51 @@
+#ifndef MIDIDRONE_RENDER_H_INCLUDED
+#define MIDIDRONE_RENDER_H_INCLUDED
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RENDER_DEFAULT_RATE 44100
+/* Channel ratio giving a 100% duty cycle */
+#define RENDER_RATIO_MAX 256
+
+/* Synthesis of what the drone PWM channels would output, into a mono
+ * 16-bit WAV file: each active channel is a square wave of its frequency,
+ * high for ratio / RENDER_RATIO_MAX of the period, with its DC component
+ * removed, and all the channels are mixed without clipping.
+ * Channel changes apply at the current position, render_advance() moves
+ * it forward. */
+struct render;
+
+struct render *render_new(const char *path, unsigned int rate,
+		unsigned int channels);
+/* Render into memory instead, see render_take_samples() */
+struct render *render_new_memory(unsigned int rate, unsigned int channels);
+/* Writes the pending samples and completes the WAV header. Returns 0, or
+ * -1 when writing the file (or growing the memory buffer) failed at some
+ * point. */
+int render_destroy(struct render *render);
+/* A freq or ratio of 0 silences the channel */
+void render_set(struct render *render, unsigned int channel, int freq,
+		int ratio);
+/* Synthesize up to date, in ns since the start. Dates in the past are
+ * ignored. */
+void render_advance(struct render *render, int64_t date);
+uint64_t render_frames(const struct render *render);
+unsigned int render_rate(const struct render *render);
+/* Memory renders only: hand the samples rendered so far over to the
+ * caller, who frees them. Returns NULL when there are none. */
+int16_t *render_take_samples(struct render *render, uint64_t *frames);
+
+/* Write interleaved 16-bit samples as a WAV file. Returns 0 or -1. */
+int render_wav_write(const char *path, unsigned int rate,
+		unsigned int channels, const int16_t *samples,
+		uint64_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libmididrone_trace
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Binary trace format of the mididrone driver calls, and static tracepoints.
+LOCAL_SRC_FILES := \
+	trace.c
+
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_CFLAGS := -std=gnu99
+
+# Static tracepoints of probes.h, in every module using this library
+ifeq ("$(MIDIDRONE_PROBES)","1")
+LOCAL_EXPORT_CFLAGS := -DMIDIDRONE_PROBES
+endif
+
+include $(BUILD_STATIC_LIBRARY)
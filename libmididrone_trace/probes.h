@@ -0,0 +1,37 @@
+#ifndef MIDIDRONE_PROBES_H_INCLUDED
+#define MIDIDRONE_PROBES_H_INCLUDED
+
+/* Static tracepoints (USDT, provider "mididrone") at the key points of the
+ * conductor, musician, player and splitter, for perf and bpftrace on the
+ * field hardware, e.g.:
+ *   perf buildid-cache --add mididrone_musician
+ *   perf record -e sdt_mididrone:timer_arm ...
+ *   bpftrace -e 'usdt:./mididrone_musician:mididrone:note { ... }'
+ * A probe is a single nop until a tracer attaches to it, its arguments
+ * are only read then. They are built with MIDIDRONE_PROBES=1 (needs
+ * <sys/sdt.h>, from systemtap-sdt-dev), and expand to nothing otherwise.
+ * Probes coming in pairs are named NAME_start and NAME_done, so that a
+ * tracer measures the time between them. Arguments are integers. */
+#ifdef MIDIDRONE_PROBES
+
+#include <sys/sdt.h>
+
+#define MIDIDRONE_PROBE(name) STAP_PROBE(mididrone, name)
+#define MIDIDRONE_PROBE1(name, a1) STAP_PROBE1(mididrone, name, a1)
+#define MIDIDRONE_PROBE2(name, a1, a2) STAP_PROBE2(mididrone, name, a1, a2)
+#define MIDIDRONE_PROBE3(name, a1, a2, a3) \
+	STAP_PROBE3(mididrone, name, a1, a2, a3)
+#define MIDIDRONE_PROBE4(name, a1, a2, a3, a4) \
+	STAP_PROBE4(mididrone, name, a1, a2, a3, a4)
+
+#else
+
+#define MIDIDRONE_PROBE(name) do {} while (0)
+#define MIDIDRONE_PROBE1(name, a1) do {} while (0)
+#define MIDIDRONE_PROBE2(name, a1, a2) do {} while (0)
+#define MIDIDRONE_PROBE3(name, a1, a2, a3) do {} while (0)
+#define MIDIDRONE_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+
+#endif
+
+#endif
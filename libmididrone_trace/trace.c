@@ -0,0 +1,197 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_writer {
+	int fd;
+	int64_t origin;
+	struct trace_record *records;
+	size_t capacity;
+	size_t count;
+	unsigned long lost;
+};
+
+struct trace_reader {
+	FILE *file;
+	struct trace_header header;
+};
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *ptr = data;
+	while (len > 0) {
+		ssize_t res = write(fd, ptr, len);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ptr += res;
+		len -= (size_t)res;
+	}
+	return 0;
+}
+
+static void flush(struct trace_writer *writer)
+{
+	if (writer->count == 0)
+		return;
+	if (write_all(writer->fd, writer->records,
+				writer->count * sizeof(struct trace_record))) {
+		printf("Failed to write trace: %s\n", strerror(errno));
+		writer->lost += writer->count;
+	}
+	writer->count = 0;
+}
+
+struct trace_writer *trace_writer_new(const char *path,
+		enum trace_source source, unsigned int channels,
+		size_t buffer_records)
+{
+	struct trace_writer *writer;
+	struct trace_header header;
+
+	writer = calloc(1, sizeof(*writer));
+	if (!writer)
+		return NULL;
+	writer->capacity = buffer_records > 0 ? buffer_records : 1;
+	writer->records = calloc(writer->capacity, sizeof(struct trace_record));
+	if (!writer->records) {
+		free(writer);
+		return NULL;
+	}
+
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	if (writer->fd == -1) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		free(writer->records);
+		free(writer);
+		return NULL;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(struct trace_record);
+	header.source = (uint16_t)source;
+	header.channels = (uint16_t)channels;
+	if (write_all(writer->fd, &header, sizeof(header))) {
+		printf("Failed to write trace: %s\n", strerror(errno));
+		close(writer->fd);
+		free(writer->records);
+		free(writer);
+		return NULL;
+	}
+
+	writer->origin = monotonic_ns();
+	return writer;
+}
+
+unsigned long trace_writer_destroy(struct trace_writer *writer)
+{
+	unsigned long lost;
+
+	if (!writer)
+		return 0;
+	flush(writer);
+	close(writer->fd);
+	lost = writer->lost;
+	free(writer->records);
+	free(writer);
+	return lost;
+}
+
+int64_t trace_writer_date(const struct trace_writer *writer)
+{
+	return monotonic_ns() - writer->origin;
+}
+
+void trace_writer_add(struct trace_writer *writer,
+		const struct trace_record *record)
+{
+	if (writer->count == writer->capacity)
+		flush(writer);
+	writer->records[writer->count++] = *record;
+}
+
+struct trace_reader *trace_reader_new(const char *path)
+{
+	struct trace_reader *reader;
+
+	reader = calloc(1, sizeof(*reader));
+	if (!reader)
+		return NULL;
+	reader->file = fopen(path, "rb");
+	if (!reader->file) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		free(reader);
+		return NULL;
+	}
+	if (fread(&reader->header, sizeof(reader->header), 1,
+				reader->file) != 1 ||
+	    reader->header.magic != TRACE_MAGIC) {
+		printf("%s is not a trace file\n", path);
+		goto error;
+	}
+	if (reader->header.version != TRACE_VERSION ||
+	    reader->header.record_size != sizeof(struct trace_record)) {
+		printf("%s: unsupported trace version %u\n", path,
+				reader->header.version);
+		goto error;
+	}
+	return reader;
+
+error:
+	fclose(reader->file);
+	free(reader);
+	return NULL;
+}
+
+void trace_reader_destroy(struct trace_reader *reader)
+{
+	if (!reader)
+		return;
+	fclose(reader->file);
+	free(reader);
+}
+
+const struct trace_header *trace_reader_header(
+		const struct trace_reader *reader)
+{
+	return &reader->header;
+}
+
+int trace_reader_next(struct trace_reader *reader,
+		struct trace_record *record)
+{
+	if (fread(record, sizeof(*record), 1, reader->file) == 1)
+		return 1;
+	return ferror(reader->file) ? -1 : 0;
+}
+
+const char *trace_type_str(uint16_t type)
+{
+	switch (type) {
+	case TRACE_ADD_NOTE: return "add_note";
+	case TRACE_UPDATE: return "update";
+	case TRACE_SET_CHANNEL: return "set_channel";
+	case TRACE_SET_FIRST_FREE: return "set_first_free";
+	case TRACE_RELEASE: return "release";
+	case TRACE_RELEASE_LCHANNEL: return "release_lchannel";
+	case TRACE_PANIC: return "panic";
+	default: return "unknown";
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef MIDIDRONE_TRACE_H_INCLUDED
+#define MIDIDRONE_TRACE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Driver call trace file: a trace_header followed by fixed-size
+ * trace_records, in native byte order. */
+#define TRACE_MAGIC 0x4d445452 /* "MDTR" */
+#define TRACE_VERSION 1
+
+/* Which Driver interface the calls were made on */
+enum trace_source {
+	TRACE_SOURCE_MUSICIAN = 1,
+	TRACE_SOURCE_PLAYER = 2,
+};
+
+enum trace_type {
+	/* Musician interface */
+	TRACE_ADD_NOTE = 1,
+	TRACE_UPDATE,
+	/* Player interface */
+	TRACE_SET_CHANNEL,
+	TRACE_SET_FIRST_FREE,
+	/* Both */
+	TRACE_RELEASE,
+	TRACE_RELEASE_LCHANNEL,
+	TRACE_PANIC,
+};
+
+struct trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint16_t source;
+	uint16_t channels;
+	uint32_t reserved;
+};
+
+struct trace_record {
+	int64_t date;      /* ns since the trace was opened */
+	int64_t ts;        /* Song date passed to the call, or -1 */
+	int64_t starttime; /* TRACE_ADD_NOTE only */
+	int64_t duration;  /* TRACE_ADD_NOTE only */
+	uint32_t freq;
+	uint16_t type;
+	int16_t channel;   /* Physical channel, or -1 */
+	int16_t lchannel;  /* Logical channel, or -1 */
+	uint16_t ratio;
+	uint8_t result;    /* Return value of the call */
+	uint8_t reserved[3];
+};
+
+struct trace_writer;
+struct trace_reader;
+
+/* Records are copied into a buffer of buffer_records records, allocated
+ * here, and only written to the file when it is full or on destroy. */
+struct trace_writer *trace_writer_new(const char *path,
+		enum trace_source source, unsigned int channels,
+		size_t buffer_records);
+/* Returns the number of records lost to write errors */
+unsigned long trace_writer_destroy(struct trace_writer *writer);
+/* ns elapsed since the trace was opened, on CLOCK_MONOTONIC */
+int64_t trace_writer_date(const struct trace_writer *writer);
+void trace_writer_add(struct trace_writer *writer,
+		const struct trace_record *record);
+
+struct trace_reader *trace_reader_new(const char *path);
+void trace_reader_destroy(struct trace_reader *reader);
+const struct trace_header *trace_reader_header(
+		const struct trace_reader *reader);
+/* Returns 1 when a record was read, 0 at the end of the trace, -1 on
+ * error */
+int trace_reader_next(struct trace_reader *reader,
+		struct trace_record *record);
+
+const char *trace_type_str(uint16_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
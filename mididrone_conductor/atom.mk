@@ -7,6 +7,7 @@ LOCAL_DESCRIPTION := Synchronization source for one or more mididrone_musicians.
 LOCAL_SRC_FILES := \
 	mididrone_conductor.c
 
+LOCAL_LIBRARIES := libmididrone_trace libmididrone_proto
 LOCAL_CFLAGS := -std=gnu99
 
 include $(BUILD_EXECUTABLE)
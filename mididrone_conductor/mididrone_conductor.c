@@ -1,34 +1,577 @@
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <probes.h>
+#include <proto.h>
 
 #define MUSICIAN_PORT 5555
 #define TIME_INTERVAL_SEC 5
+#define MULTICAST_TTL 1
+#define ANNOUNCE_INTERVAL_NSEC 100000000
+/* UIO_MAXIOV: all the targets go in a single sendmmsg() call */
+#define MAX_TARGETS 1024
+#define MAX_MUSICIANS 1024
+/* Musicians not heard of for this long are reported silent */
+#define STATUS_TIMEOUT_NSEC 3000000000LL
 
-static int send_timestamp(int sock, uint32_t curtime)
+/* Last report of a musician. The lag is the song position of the
+ * conductor when the report came in, minus the musician's one: the
+ * network delay plus the synchronization error. */
+struct musician {
+	struct sockaddr_in addr;
+	uint32_t id;
+	uint32_t seq;
+	uint32_t state;
+	int32_t position_ms;
+	int32_t offset_us;
+	uint32_t late_p99_us;
+	uint32_t events;
+	uint32_t dropped;
+	uint32_t errors;
+	int64_t lag_us;
+	struct timespec rx;
+	unsigned long reports;
+	unsigned long lost;
+};
+
+static struct musician musicians[MAX_MUSICIANS];
+static unsigned int num_musicians;
+static unsigned long ignored_reports;
+static FILE *status_log;
+
+/* A destination of every packet, with its send statistics. Latencies run
+ * from the tick, when the packet is stamped, to the return of the
+ * sendmmsg() call which sent to the target. */
+struct target {
+	struct sockaddr_in addr;
+	unsigned long sent;
+	unsigned long errors;
+	int last_error;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+};
+
+static struct target targets[MAX_TARGETS];
+static unsigned int num_targets;
+/* One message per target, all sharing the same payload */
+static struct mmsghdr msgs[MAX_TARGETS];
+static struct iovec payload;
+/* Tick to last send, over all the packets */
+static unsigned long fanouts;
+static uint64_t spread_sum;
+static uint64_t spread_max;
+static volatile sig_atomic_t quit;
+
+static void usage(void)
+{
+	printf("Usage: mididrone_conductor [-p PORT] [-t TTL] [-i IFADDR] "
+	       "[-d SEC] [-f FILE] [-l FILE] [IP_ADDR[:PORT]...]\n"
+	       "Where IP_ADDR is the IPv4 address of a "
+	       "mididrone_musician,\na broadcast address or a multicast "
+	       "group address to several mididrone_musicians.\n"
+	       "Each packet is sent to all the addresses given at once, so\n"
+	       "that a fleet can be driven by unicast when broadcast and\n"
+	       "multicast are not available.\n"
+	       "e.g. mididrone_conductor 192.168.20.255\n"
+	       "     mididrone_conductor 239.255.55.55\n"
+	       "     mididrone_conductor 192.168.20.11 192.168.20.12:5556\n"
+	       "  -p PORT    UDP port the musicians listen to (default: %d)\n"
+	       "  -t TTL     Multicast TTL (default: %d)\n"
+	       "  -i IFADDR  IPv4 address of the interface to send multicast\n"
+	       "             packets from (default: chosen by the kernel)\n"
+	       "  -d SEC     Announce the start SEC seconds in advance, so\n"
+	       "             that all musicians start at the same instant\n"
+	       "             (default: 0, start immediately)\n"
+	       "  -f FILE    Read more addresses from FILE, one per line;\n"
+	       "             '#' starts a comment (up to %d addresses)\n"
+	       "  -l FILE    Append the status reports of the musicians to\n"
+	       "             FILE, one line each. A summary of the fleet is\n"
+	       "             printed on every tick in any case\n",
+	       MUSICIAN_PORT, MULTICAST_TTL, MAX_TARGETS);
+}
+
+static void on_signal(int sig)
+{
+	quit = 1;
+}
+
+static uint64_t elapsed_ns(const struct timespec *from,
+		const struct timespec *to)
+{
+	int64_t ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 +
+		(to->tv_nsec - from->tv_nsec);
+	return ns > 0 ? (uint64_t)ns : 0;
+}
+
+static const char *target_name(const struct target *target)
+{
+	static char name[INET_ADDRSTRLEN + 8];
+	snprintf(name, sizeof(name), "%s:%u", inet_ntoa(target->addr.sin_addr),
+			ntohs(target->addr.sin_port));
+	return name;
+}
+
+/* Parse "IP_ADDR[:PORT]", PORT defaulting to port */
+static int add_target(const char *str, long int port)
+{
+	char addr[INET_ADDRSTRLEN];
+	char *endptr = NULL;
+	const char *sep = strchr(str, ':');
+	size_t len = sep ? (size_t)(sep - str) : strlen(str);
+	struct target *target;
+
+	if (num_targets == MAX_TARGETS) {
+		printf("Too many addresses, at most %d\n", MAX_TARGETS);
+		return -1;
+	}
+	target = &targets[num_targets];
+	if (len >= sizeof(addr))
+		goto invalid;
+	memcpy(addr, str, len);
+	addr[len] = '\0';
+	if (inet_aton(addr, &target->addr.sin_addr) == 0)
+		goto invalid;
+	if (sep) {
+		port = strtol(sep + 1, &endptr, 10);
+		if (endptr == sep + 1 || *endptr || port <= 0 ||
+		    port > USHRT_MAX)
+			goto invalid;
+	}
+	target->addr.sin_family = AF_INET;
+	target->addr.sin_port = htons((uint16_t)port);
+	num_targets++;
+	return 0;
+
+invalid:
+	printf("Invalid IPv4 address: %s\n", str);
+	return -1;
+}
+
+static int load_targets(const char *path, long int port)
 {
+	char line[256];
+	unsigned int lineno = 0;
+	FILE *file = fopen(path, "r");
+
+	if (!file) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		char *comment = strchr(line, '#');
+		char *token, *saveptr = NULL;
+
+		lineno++;
+		if (comment)
+			*comment = '\0';
+		for (token = strtok_r(line, " \t\r\n", &saveptr); token;
+		     token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+			if (add_target(token, port) == -1) {
+				printf("%s:%u: bad address\n", path, lineno);
+				fclose(file);
+				return -1;
+			}
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+static void setup_messages(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_targets; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		hdr->msg_name = &targets[i].addr;
+		hdr->msg_namelen = sizeof(targets[i].addr);
+		hdr->msg_iov = &payload;
+		hdr->msg_iovlen = 1;
+	}
+}
+
+/* Send one packet to every target. The kernel sends the batch until the
+ * first failing target, which is skipped before sending the rest.
+ * Returns the number of targets the packet was sent to. */
+static unsigned int fan_out(int sock, const void *data, size_t len,
+		const struct timespec *tick)
+{
+	unsigned int i, next = 0, reached = 0;
+	const struct target *failed = NULL;
+	struct timespec now = *tick;
+	uint64_t latency;
 	int res;
-	uint32_t ts = htonl(curtime);
-	res = send(sock, &ts, sizeof(ts), 0);
+
+	payload.iov_base = (void *)data;
+	payload.iov_len = len;
+	while (next < num_targets) {
+		res = sendmmsg(sock, msgs + next, num_targets - next, 0);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			targets[next].errors++;
+			targets[next].last_error = errno;
+			if (!failed)
+				failed = &targets[next];
+			next++;
+			continue;
+		}
+		latency = elapsed_ns(tick, &now);
+		for (i = next; i < next + (unsigned int)res; i++) {
+			targets[i].sent++;
+			targets[i].latency_sum += latency;
+			if (latency > targets[i].latency_max)
+				targets[i].latency_max = latency;
+		}
+		next += (unsigned int)res;
+		reached += (unsigned int)res;
+	}
+
+	latency = elapsed_ns(tick, &now);
+	fanouts++;
+	spread_sum += latency;
+	if (latency > spread_max)
+		spread_max = latency;
+	if (failed)
+		printf("Failed to send message to %u of %u targets "
+				"(first: %s: %s)\n", num_targets - reached,
+				num_targets, target_name(failed),
+				strerror(failed->last_error));
+	return reached;
+}
+
+static void print_report(void)
+{
+	unsigned int i;
+
+	if (fanouts == 0)
+		return;
+	printf("\n%u targets, %lu packets each, tick to last send: "
+			"mean %.1f us, max %.1f us\n", num_targets, fanouts,
+			spread_sum / 1000.0 / fanouts, spread_max / 1000.0);
+	printf("%-21s %8s %8s %10s %10s  %s\n", "TARGET", "SENT", "ERRORS",
+			"MEAN_US", "MAX_US", "LAST_ERROR");
+	for (i = 0; i < num_targets; i++) {
+		const struct target *target = &targets[i];
+		printf("%-21s %8lu %8lu %10.1f %10.1f  %s\n",
+				target_name(target), target->sent,
+				target->errors, target->sent ?
+				target->latency_sum / 1000.0 / target->sent :
+				0.0, target->latency_max / 1000.0,
+				target->errors ?
+				strerror(target->last_error) : "-");
+	}
+}
+
+static struct musician *find_musician(const struct sockaddr_in *addr,
+		uint32_t id)
+{
+	unsigned int i;
+	struct musician *musician;
+
+	for (i = 0; i < num_musicians; i++) {
+		musician = &musicians[i];
+		if (musician->id == id &&
+		    musician->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+		    musician->addr.sin_port == addr->sin_port)
+			return musician;
+	}
+	if (num_musicians == MAX_MUSICIANS)
+		return NULL;
+	musician = &musicians[num_musicians++];
+	memset(musician, 0, sizeof(*musician));
+	musician->addr = *addr;
+	musician->id = id;
+	return musician;
+}
+
+static const char *musician_name(const struct musician *musician)
+{
+	static char name[INET_ADDRSTRLEN + 8];
+	snprintf(name, sizeof(name), "%s:%u",
+			inet_ntoa(musician->addr.sin_addr),
+			ntohs(musician->addr.sin_port));
+	return name;
+}
+
+static void update_musician(struct musician *musician,
+		const struct status_msg *msg, const struct timespec *rx,
+		const struct timespec *start)
+{
+	uint32_t seq = ntohl(msg->seq);
+	int64_t song_us;
+
+	if (musician->reports && seq > musician->seq + 1)
+		musician->lost += seq - musician->seq - 1;
+	musician->reports++;
+	musician->seq = seq;
+	musician->state = ntohl(msg->state);
+	musician->position_ms = (int32_t)ntohl((uint32_t)msg->position_ms);
+	musician->offset_us = (int32_t)ntohl((uint32_t)msg->offset_us);
+	musician->late_p99_us = ntohl(msg->late_p99_us);
+	musician->events = ntohl(msg->events);
+	musician->dropped = ntohl(msg->dropped);
+	musician->errors = ntohl(msg->errors);
+	musician->rx = *rx;
+	song_us = (int64_t)(elapsed_ns(start, rx) / 1000);
+	musician->lag_us = song_us - (int64_t)musician->position_ms * 1000;
+
+	if (status_log)
+		fprintf(status_log, "%.3f %s %u %u %s %d %d %u %u %u %u "
+				"%lld\n", song_us / 1000000.0,
+				musician_name(musician), musician->id, seq,
+				musician->state == STATUS_ENDED ? "ended" :
+				"playing", musician->position_ms,
+				musician->offset_us, musician->late_p99_us,
+				musician->events, musician->dropped,
+				musician->errors, (long long)musician->lag_us);
+}
+
+/* Read the pending status reports, start is the date of the song start */
+static void receive_status(int sock, const struct timespec *start)
+{
+	struct status_msg msg;
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	struct timespec rx;
+	struct musician *musician;
+	ssize_t res;
+
+	while (1) {
+		addrlen = sizeof(addr);
+		res = recvfrom(sock, &msg, sizeof(msg), MSG_DONTWAIT,
+				(struct sockaddr *)&addr, &addrlen);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				printf("Failed to receive status: %s\n",
+						strerror(errno));
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &rx);
+		if (res != (ssize_t)sizeof(msg) ||
+		    ntohl(msg.magic) != STATUS_MAGIC) {
+			ignored_reports++;
+			continue;
+		}
+		musician = find_musician(&addr, ntohl(msg.id));
+		if (!musician) {
+			ignored_reports++;
+			continue;
+		}
+		update_musician(musician, &msg, &rx, start);
+	}
+}
+
+/* One line about the whole fleet: lags and offsets are only taken from
+ * the musicians still playing and heard of recently. */
+static void print_fleet(const struct timespec *now)
+{
+	unsigned int i, playing = 0, ended = 0, silent = 0;
+	unsigned long events = 0, dropped = 0, errors = 0, lost = 0;
+	int64_t lag_min = 0, lag_max = 0;
+	int32_t offset_min = 0, offset_max = 0;
+	uint32_t late_max = 0;
+
+	if (num_musicians == 0)
+		return;
+	for (i = 0; i < num_musicians; i++) {
+		const struct musician *musician = &musicians[i];
+
+		events += musician->events;
+		dropped += musician->dropped;
+		errors += musician->errors;
+		lost += musician->lost;
+		if (musician->state == STATUS_ENDED) {
+			ended++;
+			continue;
+		}
+		if (elapsed_ns(&musician->rx, now) > STATUS_TIMEOUT_NSEC) {
+			silent++;
+			continue;
+		}
+		if (playing == 0 || musician->lag_us < lag_min)
+			lag_min = musician->lag_us;
+		if (playing == 0 || musician->lag_us > lag_max)
+			lag_max = musician->lag_us;
+		if (playing == 0 || musician->offset_us < offset_min)
+			offset_min = musician->offset_us;
+		if (playing == 0 || musician->offset_us > offset_max)
+			offset_max = musician->offset_us;
+		if (musician->late_p99_us > late_max)
+			late_max = musician->late_p99_us;
+		playing++;
+	}
+	printf("Fleet: %u playing, %u ended, %u silent; lag %+.1f..%+.1f ms, "
+			"offset %+.1f..%+.1f ms, late p99 %u us; %lu events, "
+			"%lu dropped, %lu errors, %lu reports lost\n",
+			playing, ended, silent, lag_min / 1000.0,
+			lag_max / 1000.0, offset_min / 1000.0,
+			offset_max / 1000.0, late_max, events, dropped, errors,
+			lost);
+}
+
+static void print_musicians(void)
+{
+	unsigned int i;
+
+	if (num_musicians == 0)
+		return;
+	printf("\n%-21s %8s %-7s %9s %9s %9s %8s %8s %8s %6s %7s %5s\n",
+			"MUSICIAN", "ID", "STATE", "POS_S", "OFFSET_MS",
+			"LAG_MS", "P99_US", "EVENTS", "DROPPED", "ERRORS",
+			"REPORTS", "LOST");
+	for (i = 0; i < num_musicians; i++) {
+		const struct musician *musician = &musicians[i];
+		printf("%-21s %8u %-7s %9.3f %9.3f %9.3f %8u %8u %8u %6u "
+				"%7lu %5lu\n", musician_name(musician),
+				musician->id, musician->state == STATUS_ENDED ?
+				"ended" : "playing",
+				musician->position_ms / 1000.0,
+				musician->offset_us / 1000.0,
+				musician->lag_us / 1000.0,
+				musician->late_p99_us, musician->events,
+				musician->dropped, musician->errors,
+				musician->reports, musician->lost);
+	}
+	if (ignored_reports)
+		printf("%lu unexpected packets ignored\n", ignored_reports);
+}
+
+static int multicast_setup(int sock, unsigned char ttl,
+		const struct in_addr *ifaddr)
+{
+	int res;
+	unsigned char loop = 1;
+
+	res = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
 	if (res == -1) {
-		printf("Failed to send message: %s\n", strerror(errno));
+		printf("Failed to set multicast TTL: %s\n", strerror(errno));
 		return -1;
 	}
+	/* Musicians may run on the conductor's host too */
+	res = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+			sizeof(loop));
+	if (res == -1) {
+		printf("Failed to enable multicast loop: %s\n",
+				strerror(errno));
+		return -1;
+	}
+	if (ifaddr->s_addr != htonl(INADDR_ANY)) {
+		res = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, ifaddr,
+				sizeof(*ifaddr));
+		if (res == -1) {
+			printf("Failed to set multicast interface: %s\n",
+					strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int timespec_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	if (a->tv_nsec != b->tv_nsec)
+		return a->tv_nsec < b->tv_nsec ? -1 : 1;
+	return 0;
+}
+
+static int send_start(int sock, const struct timespec *now,
+		const struct timespec *start)
+{
+	struct start_msg msg = {
+		.magic = htonl(START_MAGIC),
+		.now_sec = htonl((uint32_t)now->tv_sec),
+		.now_nsec = htonl((uint32_t)now->tv_nsec),
+		.start_sec = htonl((uint32_t)start->tv_sec),
+		.start_nsec = htonl((uint32_t)start->tv_nsec),
+	};
+	return fan_out(sock, &msg, sizeof(msg), now) ? 0 : -1;
+}
+
+/* Repeat the start announcement until the start date is reached. */
+static int announce_start(int sock, const struct timespec *start)
+{
+	int res;
+	unsigned int count = 0;
+	struct timespec now, next;
+
+	printf("Start scheduled at %ld.%09ld\n", (long)start->tv_sec,
+			start->tv_nsec);
+	while (!quit) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_cmp(&now, start) >= 0)
+			break;
+		send_start(sock, &now, start);
+		count++;
+
+		next = now;
+		next.tv_nsec += ANNOUNCE_INTERVAL_NSEC;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		if (timespec_cmp(&next, start) > 0)
+			next = *start;
+		do {
+			res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&next, NULL);
+		} while (res == EINTR && !quit);
+		if (res != 0 && res != EINTR) {
+			printf("clock_nanosleep() failed: %s\n",
+					strerror(res));
+			return -1;
+		}
+	}
+	printf("Start announced %u times\n", count);
 	return 0;
 }
 
+static int send_timestamp(int sock, uint32_t curtime)
+{
+	struct timespec tick;
+	unsigned int reached;
+	uint32_t ts = htonl(curtime);
+	clock_gettime(CLOCK_MONOTONIC, &tick);
+	MIDIDRONE_PROBE2(tick_start, curtime, num_targets);
+	reached = fan_out(sock, &ts, sizeof(ts), &tick);
+	MIDIDRONE_PROBE2(tick_done, curtime, reached);
+	return reached ? 0 : -1;
+}
+
 int main(int argc, char *argv[])
 {
 	int res;
-	struct sockaddr_in dst_sin;
+	int opt;
+	long int port = MUSICIAN_PORT;
+	long int ttl = MULTICAST_TTL;
+	long int start_delay = 0;
+	char *endptr = NULL;
+	const char *targets_file = NULL;
+	const char *status_file = NULL;
+	struct timespec start, now;
+	struct pollfd fds[2];
+	struct in_addr ifaddr = { .s_addr = htonl(INADDR_ANY) };
+	struct sigaction sa;
+	unsigned int i;
+	int multicast = 0;
 	int timer = -1;
 	int sock = -1;
 	int broadcast = 1;
@@ -45,28 +588,92 @@ int main(int argc, char *argv[])
 		}
 	};
 
-	if (argc != 2) {
-		printf("Usage: mididrone_conductor IP_ADDR\n"
-		       "Where IP_ADDR is the IPv4 address of a "
-		       "mididrone_musician,\nor a broadcast address to several "
-		       "mididrone_musicians.\n"
-		       "e.g. mididrone_conductor 192.168.20.255\n");
-		return EXIT_FAILURE;
+	while ((opt = getopt(argc, argv, "d:f:hi:l:p:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			start_delay = strtol(optarg, &endptr, 0);
+			if (endptr == optarg || *endptr || start_delay < 0 ||
+			    start_delay > 3600) {
+				printf("Invalid start delay: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			targets_file = optarg;
+			break;
+		case 'l':
+			status_file = optarg;
+			break;
+		case 'i':
+			if (inet_aton(optarg, &ifaddr) == 0) {
+				printf("Invalid interface address: %s\n",
+						optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			port = strtol(optarg, &endptr, 0);
+			if (endptr == optarg || *endptr || port <= 0 ||
+			    port > USHRT_MAX) {
+				printf("Invalid port: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			ttl = strtol(optarg, &endptr, 0);
+			if (endptr == optarg || *endptr || ttl < 0 ||
+			    ttl > UCHAR_MAX) {
+				printf("Invalid TTL: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
 	}
 
-	res = inet_aton(argv[1], &dst_sin.sin_addr);
-	if (res == 0) {
-		printf("Invalid IPv4 address.\n");
+	for (; optind < argc; optind++) {
+		if (add_target(argv[optind], port) == -1)
+			return EXIT_FAILURE;
+	}
+	if (targets_file && load_targets(targets_file, port) == -1)
+		return EXIT_FAILURE;
+	if (num_targets == 0) {
+		usage();
 		return EXIT_FAILURE;
 	}
-	dst_sin.sin_family = AF_INET;
-	dst_sin.sin_port = htons(MUSICIAN_PORT);
+	setup_messages();
+
+	if (status_file) {
+		status_log = fopen(status_file, "a");
+		if (!status_log) {
+			printf("Cannot open %s: %s\n", status_file,
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+		setvbuf(status_log, NULL, _IOLBF, 0);
+		fprintf(status_log, "# SONG_S MUSICIAN ID SEQ STATE "
+				"POSITION_MS OFFSET_US LATE_P99_US EVENTS "
+				"DROPPED ERRORS LAG_US\n");
+	}
 
 	sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock == -1) {
 		printf("Could not create socket: %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
+	for (i = 0; i < num_targets; i++) {
+		if (IN_MULTICAST(ntohl(targets[i].addr.sin_addr.s_addr)))
+			multicast = 1;
+	}
+	if (multicast) {
+		res = multicast_setup(sock, (unsigned char)ttl, &ifaddr);
+		if (res == -1)
+			return EXIT_FAILURE;
+	}
+	/* Needed as soon as one of the targets is a broadcast address */
 	res = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast,
 			sizeof(broadcast));
 	if (res == -1) {
@@ -74,11 +681,13 @@ int main(int argc, char *argv[])
 				strerror(errno));
 		return EXIT_FAILURE;
 	}
-	res = connect(sock, (const struct sockaddr*)&dst_sin, sizeof(dst_sin));
-	if (res == -1) {
-		printf("Could not set peer address: %s\n", strerror(errno));
-		return EXIT_FAILURE;
-	}
+
+	/* Interrupt the waits, for the report */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
 	timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
 	if (timer == -1) {
@@ -86,19 +695,51 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	/* Send initial timestamp (0) */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (start_delay > 0) {
+		start.tv_sec += start_delay;
+		if (announce_start(sock, &start) == -1)
+			return EXIT_FAILURE;
+		if (quit)
+			goto done;
+	}
+
+	/* Send initial timestamp (0), musicians which missed all the
+	 * announcements start on it. */
 	send_timestamp(sock, ts);
 	printf("Time: %u\n", ts);
 
-	res = timerfd_settime(timer, 0, &timer_spec, NULL);
+	/* Ticks are aligned on the start date */
+	timer_spec.it_value.tv_sec += start.tv_sec;
+	timer_spec.it_value.tv_nsec = start.tv_nsec;
+	res = timerfd_settime(timer, TFD_TIMER_ABSTIME, &timer_spec, NULL);
 	if (res == -1) {
 		printf("Failed to set timer: %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
 
-	while (1) {
+	/* Status reports come back to the socket the packets leave from */
+	fds[0].fd = timer;
+	fds[0].events = POLLIN;
+	fds[1].fd = sock;
+	fds[1].events = POLLIN;
+	while (!quit) {
+		res = poll(fds, 2, -1);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			printf("poll() failed: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if (fds[1].revents & POLLIN)
+			receive_status(sock, &start);
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
 		res = read(timer, &timer_value, sizeof(timer_value));
 		if (res == -1) {
+			if (errno == EINTR)
+				continue;
 			printf("Failed to read timer: %s\n", strerror(errno));
 			return EXIT_FAILURE;
 		}
@@ -110,7 +751,15 @@ int main(int argc, char *argv[])
 		ts += (uint32_t)timer_value * TIME_INTERVAL_SEC;
 		send_timestamp(sock, ts);
 		printf("Time: %u\n", ts);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		print_fleet(&now);
 	}
 
+done:
+	receive_status(sock, &start);
+	print_report();
+	print_musicians();
+	if (status_log)
+		fclose(status_log);
 	return EXIT_SUCCESS;
 }
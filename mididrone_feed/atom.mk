@@ -0,0 +1,13 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_feed
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Follow the channel states published by mididrone_musician in shared memory.
+LOCAL_SRC_FILES := \
+	mididrone_feed.c
+
+LOCAL_LIBRARIES := libmididrone_feed
+LOCAL_CFLAGS := -std=gnu99
+
+include $(BUILD_EXECUTABLE)
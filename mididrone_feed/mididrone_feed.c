@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <feed.h>
+
+#define DEFAULT_INTERVAL_MS 10
+
+static volatile sig_atomic_t quit;
+
+static void usage(char *arg0)
+{
+	printf("Usage: %s [-i MS] [-b SEC] [NAME]\n", basename(arg0));
+	printf("Print the channel states a mididrone_musician started with\n");
+	printf("-m NAME publishes, each time they change\n");
+	printf("(default NAME: %s).\n", FEED_DEFAULT_NAME);
+	printf("  -h      Show this usage screen and exit\n");
+	printf("  -i MS   Look for changes every MS milliseconds\n");
+	printf("          (default: %d)\n", DEFAULT_INTERVAL_MS);
+	printf("  -b SEC  Benchmark: read snapshots back to back for SEC\n");
+	printf("          seconds, and report the cost of a read\n");
+}
+
+static void on_signal(int sig)
+{
+	quit = 1;
+}
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void print_snapshot(const struct feed_snapshot *snapshot)
+{
+	unsigned int i;
+
+	printf("%10.3f", snapshot->song_time / 1000000000.0);
+	for (i = 0; i < snapshot->channels && i < FEED_MAX_CHANNELS; i++) {
+		const struct feed_channel *chan = &snapshot->chans[i];
+		if (chan->busy)
+			printf(" | %u: %5d Hz %3d l%-2d", i, chan->freq,
+					chan->ratio, chan->lchannel);
+		else
+			printf(" | %u: %-15s", i, "-");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static int follow(struct feed_reader *reader, unsigned int interval_ms)
+{
+	struct feed_snapshot snapshot;
+	struct timespec period = {
+		.tv_sec = interval_ms / 1000,
+		.tv_nsec = (long)(interval_ms % 1000) * 1000000,
+	};
+	int res;
+
+	while (!quit) {
+		res = feed_reader_read(reader, &snapshot);
+		if (res == -1) {
+			printf("No consistent snapshot, writer stuck?\n");
+			return -1;
+		}
+		if (res == 1)
+			print_snapshot(&snapshot);
+		nanosleep(&period, NULL);
+	}
+	return 0;
+}
+
+static int benchmark(struct feed_reader *reader, unsigned int seconds)
+{
+	struct feed_snapshot snapshot;
+	unsigned long reads = 0, updates = 0, failed = 0;
+	int64_t start = monotonic_ns();
+	int64_t end = start + (int64_t)seconds * 1000000000LL;
+	int64_t now = start;
+
+	while (!quit && now < end) {
+		unsigned int i;
+		/* Keep the clock out of the measure */
+		for (i = 0; i < 1024; i++) {
+			int res = feed_reader_read(reader, &snapshot);
+			if (res == 1)
+				updates++;
+			else if (res == -1)
+				failed++;
+		}
+		reads += i;
+		now = monotonic_ns();
+	}
+	printf("%lu reads in %.3f s: %.1f ns per read, %lu updates seen, "
+			"%lu failed\n", reads, (now - start) / 1000000000.0,
+			reads ? (double)(now - start) / reads : 0.0, updates,
+			failed);
+	return failed ? -1 : 0;
+}
+
+static int parse_uint(const char *str, unsigned int max, unsigned int *val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return -1;
+	*val = (unsigned int)res;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct feed_reader *reader;
+	const char *name = FEED_DEFAULT_NAME;
+	unsigned int interval_ms = DEFAULT_INTERVAL_MS;
+	unsigned int bench_sec = 0;
+	int opt, res;
+
+	while ((opt = getopt(argc, argv, "b:hi:")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (parse_uint(optarg, 3600, &bench_sec) ||
+			    bench_sec == 0) {
+				printf("Invalid value for -b: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'i':
+			if (parse_uint(optarg, 10000, &interval_ms) ||
+			    interval_ms == 0) {
+				printf("Invalid value for -i: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc - optind == 1)
+		name = argv[optind];
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	reader = feed_reader_new(name);
+	if (!reader)
+		return EXIT_FAILURE;
+	if (bench_sec)
+		res = benchmark(reader, bench_sec);
+	else
+		res = follow(reader, interval_ms);
+	feed_reader_destroy(reader);
+	return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,22 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_fleet
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Simulate a fleet of musicians in one process, to test the conductor protocol and the splitter output at scale
+LOCAL_SRC_FILES := \
+	mididrone_fleet.cpp \
+	virtual_driver.cpp \
+	../mididrone_musician/async_log.cpp \
+	../mididrone_musician/conductor_listener.cpp \
+	../mididrone_musician/scheduler.cpp \
+	../mididrone_musician/score.cpp \
+	../mididrone_musician/sync_filter.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../mididrone_musician
+LOCAL_LIBRARIES := portsmf libpomp libfutils libmididrone_trace \
+	libmididrone_proto
+LOCAL_CXXFLAGS := -std=c++0x
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_EXECUTABLE)
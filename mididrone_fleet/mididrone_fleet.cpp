@@ -0,0 +1,509 @@
+#include <getopt.h>
+#include <libgen.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <libpomp.h>
+#include <futils/futils.h>
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <cstdio>
+#include "score.h"
+#include "scheduler.h"
+#include "sync_filter.h"
+#include "conductor_listener.h"
+#include "virtual_driver.h"
+
+#define CONDUCTOR_PORT 5555
+/* Channels of a virtual musician, as many as the drone's motors */
+#define DEFAULT_CHANNELS 4
+#define MAX_MUSICIANS 10000
+
+static sig_atomic_t quit = 0;
+
+struct opts {
+	bool ok;
+	unsigned int musicians;
+	unsigned int channels;
+	unsigned int port;
+	struct in_addr group;
+	struct in_addr ifaddr;
+	SyncFilter::Method sync_method;
+	unsigned int sync_window;
+	unsigned int slack_us;
+	int first_file;
+	int num_files;
+};
+
+/* One simulated mididrone_musician */
+struct VirtualMusician {
+	const char *filename;
+	const Score *score;
+	VirtualDriver *driver;
+	Scheduler *scheduler;
+};
+
+/* Next wakeup of a virtual musician */
+struct Deadline {
+	nsec_t date;
+	unsigned int idx;
+};
+
+/* All the virtual musicians hear the same conductor packets at the same
+ * dates: they share one clock. */
+static nsec_t time_offset = 0;
+static nsec_t time_error = 0;
+static ConductorListener *listener = NULL;
+
+static struct pomp_loop *loop = NULL;
+static int sched_timer = -1;
+
+static std::vector<Score*> scores;
+static std::vector<VirtualMusician> musicians;
+/* Min-heap of the pending wakeups, at most one per musician */
+static std::vector<Deadline> deadlines;
+static nsec_t slack = 0;
+static unsigned long timer_wakeups = 0;
+static nsec_t song_end = 0;
+static struct rusage usage_start;
+static struct timespec wall_start;
+
+static nsec_t get_time()
+{
+	struct timespec ts;
+	time_get_monotonic(&ts);
+	return timespec_to_ns(&ts) - time_offset + time_error;
+}
+
+static nsec_t musician_clock(void *userdata)
+{
+	return get_time();
+}
+
+/* std heap functions build a max-heap: the latest deadline sinks */
+static bool later(const Deadline& a, const Deadline& b)
+{
+	return a.date > b.date;
+}
+
+static void arm_sched_timer(nsec_t ts)
+{
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	ns_to_timespec(ts - time_error + time_offset, &spec.it_value);
+	/* A zero date would disarm the timer */
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+	if (timerfd_settime(sched_timer, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+		printf("Failed to arm scheduler timer: %s\n", strerror(errno));
+}
+
+/* Run every musician due now, then sleep until the next one is */
+static void process_and_schedule(void)
+{
+	nsec_t now = get_time();
+
+	while (!deadlines.empty() && deadlines.front().date <= now + slack) {
+		std::pop_heap(deadlines.begin(), deadlines.end(), later);
+		Deadline& deadline(deadlines.back());
+		nsec_t next = musicians[deadline.idx].scheduler->process(now);
+		if (next < 0) {
+			deadlines.pop_back();
+			if (now > song_end)
+				song_end = now;
+			continue;
+		}
+		deadline.date = next;
+		std::push_heap(deadlines.begin(), deadlines.end(), later);
+	}
+
+	if (deadlines.empty()) {
+		/* Every musician reached the end of its song */
+		quit = 1;
+		pomp_loop_wakeup(loop);
+		return;
+	}
+	arm_sched_timer(deadlines.front().date);
+}
+
+static void sig_handler(int sig)
+{
+	quit = 1;
+	pomp_loop_wakeup(loop);
+}
+
+static void sched_timer_handler(int fd, uint32_t revents, void *userdata)
+{
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == -1) {
+		if (errno != EAGAIN)
+			printf("read() failed: %s\n", strerror(errno));
+		return;
+	}
+	timer_wakeups++;
+	process_and_schedule();
+}
+
+/* Conductor listener callbacks */
+static void go(const struct timespec *start, void *userdata)
+{
+	time_offset = timespec_to_ns(start);
+	getrusage(RUSAGE_SELF, &usage_start);
+	time_get_monotonic(&wall_start);
+	deadlines.clear();
+	for (unsigned int i = 0; i < musicians.size(); i++) {
+		Deadline deadline = { 0, i };
+		deadlines.push_back(deadline);
+	}
+	std::make_heap(deadlines.begin(), deadlines.end(), later);
+	process_and_schedule();
+}
+
+static void clock_corrected(nsec_t error, void *userdata)
+{
+	time_error = error;
+	/* The deadlines moved on the monotonic clock */
+	if (!quit && !deadlines.empty())
+		arm_sched_timer(deadlines.front().date);
+}
+
+static void conductor_failed(void *userdata)
+{
+	quit = 1;
+	pomp_loop_wakeup(loop);
+}
+
+static const ConductorListener::Callbacks listener_cbs = {
+	.go = go,
+	.corrected = clock_corrected,
+	.heard = NULL,
+	.failed = conductor_failed,
+};
+
+static int timer_setup(int *timer, pomp_fd_event_cb_t cb)
+{
+	int res;
+
+	*timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (*timer == -1) {
+		printf("timerfd_create() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	res = pomp_loop_add(loop, *timer, POMP_FD_EVENT_IN, cb, NULL);
+	if (res) {
+		printf("pomp_loop_add() failed: %s\n", strerror(-res));
+		close(*timer);
+		*timer = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static double timeval_sec(const struct timeval *tv)
+{
+	return (double)tv->tv_sec + (double)tv->tv_usec / 1000000.0;
+}
+
+static void print_report(void)
+{
+	struct rusage usage;
+	struct timespec now;
+	double user, sys, wall, song;
+	Scheduler::Stats total;
+	unsigned long onsets = 0, refused = 0;
+	nsec_t error_sum = 0, worst = 0;
+	unsigned int worst_idx = 0;
+
+	getrusage(RUSAGE_SELF, &usage);
+	time_get_monotonic(&now);
+	user = timeval_sec(&usage.ru_utime) - timeval_sec(&usage_start.ru_utime);
+	sys = timeval_sec(&usage.ru_stime) - timeval_sec(&usage_start.ru_stime);
+	wall = ns_to_sec(timespec_to_ns(&now) - timespec_to_ns(&wall_start));
+	/* Interrupted: some musicians are still playing */
+	song = ns_to_sec(deadlines.empty() ? song_end : get_time());
+	if (wall <= 0.0)
+		wall = 1e-9;
+	if (song <= 0.0)
+		song = wall;
+
+	printf("\n%-4s %-24s %6s %8s %9s %9s %9s %7s\n", "#", "FILE", "NOTES",
+			"WAKEUPS", "MEAN_US", "MIN_US", "MAX_US", "REFUSED");
+	memset(&total, 0, sizeof(total));
+	for (unsigned int i = 0; i < musicians.size(); i++) {
+		const VirtualMusician& musician(musicians[i]);
+		const Scheduler::Stats& stats(musician.scheduler->stats());
+		const VirtualDriver::Stats& onset(musician.driver->stats());
+		char name[PATH_MAX];
+
+		total.events += stats.events;
+		total.driverCalls += stats.driverCalls;
+		total.wakeups += stats.wakeups;
+		total.coalesced += stats.coalesced;
+		if (onset.onsets && (onsets == 0 || onset.errorMax > worst)) {
+			worst = onset.errorMax;
+			worst_idx = i;
+		}
+		onsets += onset.onsets;
+		refused += onset.refused;
+		error_sum += onset.errorSum;
+
+		snprintf(name, sizeof(name), "%s", musician.filename);
+		printf("%-4u %-24s %6lu %8lu %9.1f %9.1f %9.1f %7lu\n", i,
+				basename(name), onset.onsets, stats.wakeups,
+				onset.onsets ? (double)onset.errorSum /
+				onset.onsets / 1000.0 : 0.0,
+				(double)onset.errorMin / 1000.0,
+				(double)onset.errorMax / 1000.0, onset.refused);
+	}
+
+	printf("\nFleet: %zu musicians, %.3f s of song in %.3f s\n",
+			musicians.size(), song, wall);
+	printf("CPU: user %.3f s, system %.3f s, %.2f%% of one core, "
+			"%.1f us per musician per second of song\n",
+			user, sys, (user + sys) * 100.0 / wall,
+			(user + sys) * 1e6 / musicians.size() / song);
+	printf("Wakeups: %lu timer, %lu scheduler (%lu coalesced), "
+			"%lu events, %lu driver calls\n", timer_wakeups,
+			total.wakeups, total.coalesced, total.events,
+			total.driverCalls);
+	printf("Onset error: mean %.1f us, worst %.1f us (musician %u), "
+			"%lu onsets, %lu refused\n",
+			onsets ? (double)error_sum / onsets / 1000.0 : 0.0,
+			(double)worst / 1000.0, worst_idx, onsets, refused);
+}
+
+static void usage(char* arg0)
+{
+	printf("Usage: %s [-n N] [-c N] [-k US] [-p PORT] "
+			"[-g GROUP [-i IFADDR]] [-s METHOD] [-w N] "
+			"MIDIFILE...\n", basename(arg0));
+	printf("Play the per-drone files written by mididrone_splitter on\n");
+	printf("virtual musicians sharing one process, one event loop and\n");
+	printf("one conductor socket, and report the CPU cost, the wakeups\n");
+	printf("and the onset error of each of them.\n");
+	printf("  -h      Show this usage screen and exit\n");
+	printf("  -n N    Number of virtual musicians, the files are assigned\n");
+	printf("          to them in turn (default: one per file, max: %u)\n",
+			MAX_MUSICIANS);
+	printf("  -c N    Channels of each virtual musician (default: %d)\n",
+			DEFAULT_CHANNELS);
+	printf("  -k US   Wakeup slack, see mididrone_musician (default: 0)\n");
+	printf("  -p PORT UDP port to listen on for conductor messages\n");
+	printf("          (default: %d)\n", CONDUCTOR_PORT);
+	printf("  -g GROUP  Join the multicast GROUP to receive conductor\n");
+	printf("            messages\n");
+	printf("  -i IFADDR IPv4 address of the interface to join the group\n");
+	printf("            on (default: chosen by the kernel)\n");
+	printf("  -s METHOD Clock offset filter: mindelay or median\n");
+	printf("          (default: mindelay)\n");
+	printf("  -w N    Clock offset filter window, in conductor messages\n");
+	printf("          (default: 8, max: %u)\n", SyncFilter::maxWindow);
+}
+
+static bool parse_uint(const char* str, unsigned int max, unsigned int* val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return false;
+	*val = (unsigned int)res;
+	return true;
+}
+
+static struct opts parse_opts(int argc, char* argv[])
+{
+	struct opts opts = {
+		.ok = false,
+		.musicians = 0,
+		.channels = DEFAULT_CHANNELS,
+		.port = CONDUCTOR_PORT,
+		.group = { .s_addr = htonl(INADDR_ANY) },
+		.ifaddr = { .s_addr = htonl(INADDR_ANY) },
+		.sync_method = SyncFilter::MIN_DELAY,
+		.sync_window = 8,
+		.slack_us = 0,
+		.first_file = 0,
+		.num_files = 0,
+	};
+	int opt = -1;
+	unsigned int val;
+
+	while((opt = getopt(argc, argv, ":c:g:hi:k:n:p:s:w:")) != -1) {
+		switch(opt) {
+		case 'c':
+			if (!parse_uint(optarg, 64, &val) || val == 0) {
+				printf("Invalid value for -c: %s\n", optarg);
+				return opts;
+			}
+			opts.channels = val;
+			break;
+		case 'g':
+			if (inet_aton(optarg, &opts.group) == 0 ||
+			    !IN_MULTICAST(ntohl(opts.group.s_addr))) {
+				printf("Invalid multicast group: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'i':
+			if (inet_aton(optarg, &opts.ifaddr) == 0) {
+				printf("Invalid interface address: %s\n",
+						optarg);
+				return opts;
+			}
+			break;
+		case 'k':
+			if (!parse_uint(optarg, 1000000, &val)) {
+				printf("Invalid value for -k: %s\n", optarg);
+				return opts;
+			}
+			opts.slack_us = val;
+			break;
+		case 'n':
+			if (!parse_uint(optarg, MAX_MUSICIANS, &val) ||
+			    val == 0) {
+				printf("Invalid value for -n: %s\n", optarg);
+				return opts;
+			}
+			opts.musicians = val;
+			break;
+		case 'p':
+			if (!parse_uint(optarg, 65535, &val) || val == 0) {
+				printf("Invalid value for -p: %s\n", optarg);
+				return opts;
+			}
+			opts.port = val;
+			break;
+		case 's':
+			if (strcmp(optarg, "median") == 0) {
+				opts.sync_method = SyncFilter::MEDIAN;
+			} else if (strcmp(optarg, "mindelay") == 0) {
+				opts.sync_method = SyncFilter::MIN_DELAY;
+			} else {
+				printf("Invalid value for -s: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'w':
+			if (!parse_uint(optarg, SyncFilter::maxWindow, &val) ||
+			    val == 0) {
+				printf("Invalid value for -w: %s\n", optarg);
+				return opts;
+			}
+			opts.sync_window = val;
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if (argc - optind < 1) {
+		usage(argv[0]);
+		return opts;
+	}
+
+	opts.first_file = optind;
+	opts.num_files = argc - optind;
+	if (opts.musicians == 0) {
+		if (opts.num_files > MAX_MUSICIANS) {
+			printf("Too many files, at most %u\n", MAX_MUSICIANS);
+			return opts;
+		}
+		opts.musicians = (unsigned int)opts.num_files;
+	}
+	opts.ok = true;
+	return opts;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
+		return 1;
+
+	loop = pomp_loop_new();
+
+	signal(SIGINT, sig_handler);
+	signal(SIGQUIT, sig_handler);
+	signal(SIGHUP, sig_handler);
+
+	/* Each file is decoded once, whatever the number of musicians
+	 * playing it */
+	for (int i = 0; i < opts.num_files; i++) {
+		Score *score = new Score();
+		score->load(argv[opts.first_file + i]);
+		scores.push_back(score);
+	}
+
+	slack = (nsec_t)opts.slack_us * 1000;
+	musicians.resize(opts.musicians);
+	for (unsigned int i = 0; i < opts.musicians; i++) {
+		VirtualMusician& musician(musicians[i]);
+		int file = (int)(i % (unsigned int)opts.num_files);
+		musician.filename = argv[opts.first_file + file];
+		musician.score = scores[file];
+		musician.driver = new VirtualDriver((int)opts.channels,
+				musician_clock, &musician);
+		musician.scheduler = new DriverScheduler<VirtualDriver>(
+				*musician.score, musician.driver);
+		musician.scheduler->setSlack(slack);
+		musician.scheduler->start();
+	}
+	deadlines.reserve(musicians.size());
+
+	listener = new ConductorListener(loop, opts.sync_method,
+			opts.sync_window, listener_cbs, NULL);
+	if (!listener->start(opts.port, &opts.group, &opts.ifaddr)) {
+		printf("Failed to listen to the conductor!\n");
+		return EXIT_FAILURE;
+	}
+	if (timer_setup(&sched_timer, sched_timer_handler)) {
+		printf("sched_timer_setup() failed!\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Fleet of %u musicians playing %d files, waiting for the "
+			"conductor\n", opts.musicians, opts.num_files);
+
+	while(!quit) {
+		pomp_loop_wait_and_process(loop, -1);
+	}
+
+	if (listener->started())
+		print_report();
+
+	delete listener;
+	listener = NULL;
+	pomp_loop_remove(loop, sched_timer);
+	close(sched_timer);
+	pomp_loop_destroy(loop);
+	loop = NULL;
+
+	for (unsigned int i = 0; i < musicians.size(); i++) {
+		delete musicians[i].scheduler;
+		delete musicians[i].driver;
+	}
+	for (unsigned int i = 0; i < scores.size(); i++)
+		delete scores[i];
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "virtual_driver.h"
+#include <cstring>
+
+VirtualDriver::VirtualDriver(int channels, ClockFn clock, void *userdata) :
+	mNumChans(channels),
+	mChans(new ChannelState[channels]),
+	mClock(clock),
+	mUserdata(userdata)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	panic();
+}
+
+VirtualDriver::~VirtualDriver()
+{
+	delete[] mChans;
+}
+
+int VirtualDriver::channels()
+{
+	return mNumChans;
+}
+
+ChannelState VirtualDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool VirtualDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	nsec_t error = mClock(mUserdata) - starttime;
+
+	update(ts);
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy)
+			continue;
+		chan.busy = true;
+		chan.freq = freq;
+		chan.ratio = ratio;
+		chan.lchannel = lchannel;
+		chan.stoptime = starttime + duration;
+
+		if (mStats.onsets == 0 || error < mStats.errorMin)
+			mStats.errorMin = error;
+		if (mStats.onsets == 0 || error > mStats.errorMax)
+			mStats.errorMax = error;
+		mStats.errorSum += error;
+		mStats.onsets++;
+		return true;
+	}
+	mStats.refused++;
+	return false;
+}
+
+void VirtualDriver::update(nsec_t ts)
+{
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.stoptime <= ts)
+			releaseChannel(i);
+	}
+}
+
+nsec_t VirtualDriver::nextEventTime()
+{
+	nsec_t closest = -1;
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && (closest < 0 || chan.stoptime < closest))
+			closest = chan.stoptime;
+	}
+	return closest;
+}
+
+void VirtualDriver::releaseChannel(int idx)
+{
+	mChans[idx].busy = false;
+	mChans[idx].lchannel = -1;
+}
+
+bool VirtualDriver::releaseLChannel(int lchan)
+{
+	bool success = false;
+	for (int i = 0; i < mNumChans; i ++) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.lchannel == lchan) {
+			releaseChannel(i);
+			success = true;
+		}
+	}
+	return success;
+}
+
+void VirtualDriver::panic()
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		releaseChannel(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+}
+
+const VirtualDriver::Stats& VirtualDriver::stats() const
+{
+	return mStats;
+}
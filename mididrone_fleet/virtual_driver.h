@@ -0,0 +1,43 @@
+#ifndef VIRTUAL_DRIVER_H_INCLUDED
+#define VIRTUAL_DRIVER_H_INCLUDED
+
+#include "driver.h"
+
+/* Driver of a virtual musician: channel bookkeeping only, no output.
+ * Each note start is compared with the song date read on the musician's
+ * clock at the time of the call, which gives its onset error. */
+class VirtualDriver final : public Driver
+{
+public:
+	/* Current song date of the musician */
+	typedef nsec_t (*ClockFn)(void *userdata);
+
+	struct Stats {
+		unsigned long onsets;
+		unsigned long refused; // No free channel
+		nsec_t errorSum;
+		nsec_t errorMin;
+		nsec_t errorMax;
+	};
+
+	VirtualDriver(int channels, ClockFn clock, void *userdata);
+	virtual ~VirtualDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	const Stats& stats() const;
+private:
+	int mNumChans;
+	ChannelState *mChans;
+	ClockFn mClock;
+	void *mUserdata;
+	Stats mStats;
+};
+
+#endif
@@ -0,0 +1,19 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_mixdown
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Render the per-drone files of a show in parallel and mix them into one stereo WAV preview
+LOCAL_SRC_FILES := \
+	mididrone_mixdown.cpp \
+	overflow_driver.cpp \
+	../mididrone_musician/render_driver.cpp \
+	../mididrone_musician/scheduler.cpp \
+	../mididrone_musician/score.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../mididrone_musician
+LOCAL_LIBRARIES := portsmf libmididrone_render libmididrone_trace
+LOCAL_CXXFLAGS := -std=c++0x
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,347 @@
+#include <math.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <render.h>
+#include "score.h"
+#include "scheduler.h"
+#include "render_driver.h"
+#include "overflow_driver.h"
+
+/* Channels of a drone, as many as its motors */
+#define DEFAULT_CHANNELS 4
+#define MAX_JOBS 256
+/* Refused note dates listed per drone */
+#define MAX_REPORTED_OVERFLOWS 8
+
+struct opts {
+	bool ok;
+	unsigned int jobs;
+	unsigned int channels;
+	unsigned int rate;
+	const char* output;
+	int first_file;
+	int num_files;
+};
+
+struct Drone {
+	const char *filename;
+	Score score;
+	/* Equal-power gains placing the drone across the stereo field */
+	float left;
+	float right;
+	nsec_t length;
+	double renderSec;
+	std::vector<nsec_t> refused;
+	bool ok;
+};
+
+static std::vector<Drone> drones;
+static std::atomic<unsigned int> next_drone(0);
+static unsigned int channels = DEFAULT_CHANNELS;
+static unsigned int rate = RENDER_DEFAULT_RATE;
+
+/* Stereo mix, interleaved */
+static pthread_mutex_t mix_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<float> mix;
+
+static double monotonic_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void mix_drone(const Drone& drone, const int16_t *samples,
+		uint64_t frames)
+{
+	pthread_mutex_lock(&mix_lock);
+	if (mix.size() < frames * 2)
+		mix.resize(frames * 2, 0.0f);
+	float *out = &mix[0];
+	for (uint64_t i = 0; i < frames; i++) {
+		out[2 * i] += drone.left * samples[i];
+		out[2 * i + 1] += drone.right * samples[i];
+	}
+	pthread_mutex_unlock(&mix_lock);
+}
+
+/* Play the drone's score as fast as possible on a memory render, the way
+ * mididrone_musician -F -W does, then add it to the mix. */
+static void render_drone(Drone& drone)
+{
+	double start = monotonic_sec();
+	struct render *render = render_new_memory(rate, channels);
+	if (!render) {
+		printf("%s: cannot create renderer\n", drone.filename);
+		return;
+	}
+	OverflowDriver driver(new RenderDriver(render, (int)channels));
+	DriverScheduler<OverflowDriver> scheduler(drone.score, &driver);
+	nsec_t ts = 0;
+
+	scheduler.start();
+	while (1) {
+		nsec_t next = scheduler.process(ts);
+		if (next < 0)
+			break;
+		ts = next;
+	}
+	drone.length = ts;
+	drone.refused = driver.refused();
+
+	/* The driver owns the render, take the samples out before it goes */
+	uint64_t frames;
+	int16_t *samples = render_take_samples(render, &frames);
+	drone.renderSec = monotonic_sec() - start;
+	if (samples)
+		mix_drone(drone, samples, frames);
+	free(samples);
+	drone.ok = true;
+}
+
+static void* worker(void *arg)
+{
+	unsigned int idx;
+	while ((idx = next_drone.fetch_add(1)) < drones.size())
+		render_drone(drones[idx]);
+	return NULL;
+}
+
+static int write_mix(const char *path, double *gain_db)
+{
+	float peak = 0.0f;
+	float gain = 1.0f;
+	std::vector<int16_t> samples(mix.size());
+
+	for (size_t i = 0; i < mix.size(); i++) {
+		if (fabsf(mix[i]) > peak)
+			peak = fabsf(mix[i]);
+	}
+	/* Several drones add up: scale the mix down to fit */
+	if (peak > INT16_MAX)
+		gain = INT16_MAX / peak;
+	*gain_db = 20.0 * log10(gain);
+	for (size_t i = 0; i < mix.size(); i++)
+		samples[i] = (int16_t)lrintf(mix[i] * gain);
+	return render_wav_write(path, rate, 2, samples.empty() ? NULL :
+			&samples[0], mix.size() / 2);
+}
+
+static void print_report(unsigned int jobs, double wall, double gain_db)
+{
+	nsec_t length = 0;
+	double render_total = 0.0;
+	unsigned long overflows = 0;
+
+	printf("\n%-4s %-24s %6s %9s %10s %8s %8s\n", "#", "FILE", "NOTES",
+			"LENGTH_S", "RENDER_MS", "SPEED", "REFUSED");
+	for (unsigned int i = 0; i < drones.size(); i++) {
+		const Drone& drone(drones[i]);
+		char name[PATH_MAX];
+
+		if (!drone.ok)
+			continue;
+		if (drone.length > length)
+			length = drone.length;
+		render_total += drone.renderSec;
+		overflows += drone.refused.size();
+		snprintf(name, sizeof(name), "%s", drone.filename);
+		printf("%-4u %-24s %6zu %9.3f %10.1f %7.0fx %8zu\n", i,
+				basename(name), drone.score.size(),
+				ns_to_sec(drone.length),
+				drone.renderSec * 1000.0,
+				drone.renderSec > 0.0 ? ns_to_sec(drone.length) /
+				drone.renderSec : 0.0, drone.refused.size());
+	}
+
+	if (overflows) {
+		printf("\nPolyphony above %u channels (notes refused, "
+				"\"No free channel!\" on the drone):\n",
+				channels);
+		for (unsigned int i = 0; i < drones.size(); i++) {
+			const Drone& drone(drones[i]);
+			char name[PATH_MAX];
+			size_t count = drone.refused.size();
+
+			if (count == 0)
+				continue;
+			snprintf(name, sizeof(name), "%s", drone.filename);
+			printf("  %s: %zu at", basename(name), count);
+			for (size_t j = 0; j < count &&
+					j < MAX_REPORTED_OVERFLOWS; j++)
+				printf(" %.3f", ns_to_sec(drone.refused[j]));
+			printf(count > MAX_REPORTED_OVERFLOWS ? " ... s\n" :
+					" s\n");
+		}
+	}
+
+	if (wall <= 0.0)
+		wall = 1e-9;
+	printf("\nMixdown: %zu drones, %.3f s of song in %.3f s on %u "
+			"threads (x%.0f real time)\n", drones.size(),
+			ns_to_sec(length), wall, jobs, ns_to_sec(length) / wall);
+	printf("Render: %.3f s in total over the threads, %.1f "
+			"drone-seconds of song per second\n", render_total,
+			ns_to_sec(length) * drones.size() / wall);
+	printf("Mix gain: %.1f dB\n", gain_db);
+}
+
+static void usage(char* arg0)
+{
+	printf("Usage: %s [-j N] [-c N] [-r RATE] OUTPUT MIDIFILE...\n",
+			basename(arg0));
+	printf("Render the per-drone files written by mididrone_splitter\n");
+	printf("in parallel, and mix them into the stereo WAV file OUTPUT,\n");
+	printf("the drones spread from left to right in order.\n");
+	printf("  -h      Show this usage screen and exit\n");
+	printf("  -j N    Render N drones at once (default: one per CPU)\n");
+	printf("  -c N    Channels of each drone (default: %d)\n",
+			DEFAULT_CHANNELS);
+	printf("  -r RATE Sample rate, in Hz (default: %d)\n",
+			RENDER_DEFAULT_RATE);
+}
+
+static bool parse_uint(const char* str, unsigned int max, unsigned int* val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return false;
+	*val = (unsigned int)res;
+	return true;
+}
+
+static struct opts parse_opts(int argc, char* argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct opts opts = {
+		.ok = false,
+		.jobs = cpus > 0 ? (unsigned int)cpus : 1,
+		.channels = DEFAULT_CHANNELS,
+		.rate = RENDER_DEFAULT_RATE,
+		.output = nullptr,
+		.first_file = 0,
+		.num_files = 0,
+	};
+	int opt = -1;
+	unsigned int val;
+
+	while((opt = getopt(argc, argv, ":c:hj:r:")) != -1) {
+		switch(opt) {
+		case 'c':
+			if (!parse_uint(optarg, 64, &val) || val == 0) {
+				printf("Invalid value for -c: %s\n", optarg);
+				return opts;
+			}
+			opts.channels = val;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'j':
+			if (!parse_uint(optarg, MAX_JOBS, &val) || val == 0) {
+				printf("Invalid value for -j: %s\n", optarg);
+				return opts;
+			}
+			opts.jobs = val;
+			break;
+		case 'r':
+			if (!parse_uint(optarg, 192000, &val) || val < 8000) {
+				printf("Invalid value for -r: %s\n", optarg);
+				return opts;
+			}
+			opts.rate = val;
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage(argv[0]);
+		return opts;
+	}
+
+	opts.output = argv[optind];
+	opts.first_file = optind + 1;
+	opts.num_files = argc - optind - 1;
+	opts.ok = true;
+	return opts;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
+		return 1;
+
+	channels = opts.channels;
+	rate = opts.rate;
+
+	/* Decode every file up front, the renders then share nothing but
+	 * the mix */
+	drones.resize(opts.num_files);
+	for (int i = 0; i < opts.num_files; i++) {
+		Drone& drone(drones[i]);
+		double pan = opts.num_files > 1 ?
+			(double)i / (opts.num_files - 1) : 0.5;
+		drone.filename = argv[opts.first_file + i];
+		drone.score.load(drone.filename);
+		drone.left = (float)cos(pan * M_PI / 2.0);
+		drone.right = (float)sin(pan * M_PI / 2.0);
+		drone.length = 0;
+		drone.renderSec = 0.0;
+		drone.ok = false;
+	}
+
+	unsigned int jobs = std::min(opts.jobs, (unsigned int)drones.size());
+	std::vector<pthread_t> threads(jobs);
+	double start = monotonic_sec();
+	unsigned int started = 0;
+	for (unsigned int i = 0; i < jobs; i++) {
+		int res = pthread_create(&threads[started], NULL, worker, NULL);
+		if (res) {
+			printf("Failed to create render thread: %s\n",
+					strerror(res));
+			break;
+		}
+		started++;
+	}
+	/* No thread at all: render here */
+	if (started == 0)
+		worker(NULL);
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	double wall = monotonic_sec() - start;
+
+	double gain_db;
+	int res = write_mix(opts.output, &gain_db);
+	print_report(started ? started : 1, wall, gain_db);
+	for (unsigned int i = 0; i < drones.size(); i++) {
+		if (!drones[i].ok)
+			res = -1;
+	}
+	if (res)
+		return EXIT_FAILURE;
+	printf("Written: %s\n", opts.output);
+	return 0;
+}
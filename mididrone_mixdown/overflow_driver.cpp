@@ -0,0 +1,62 @@
+#include "overflow_driver.h"
+
+OverflowDriver::OverflowDriver(Driver *driver) :
+	mDriver(driver),
+	mRefused()
+{
+}
+
+OverflowDriver::~OverflowDriver()
+{
+	delete mDriver;
+}
+
+int OverflowDriver::channels()
+{
+	return mDriver->channels();
+}
+
+ChannelState OverflowDriver::channelState(int idx)
+{
+	return mDriver->channelState(idx);
+}
+
+bool OverflowDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	bool res = mDriver->addNote(ts, starttime, lchannel, freq, ratio,
+			duration);
+	if (!res)
+		mRefused.push_back(starttime);
+	return res;
+}
+
+void OverflowDriver::update(nsec_t ts)
+{
+	mDriver->update(ts);
+}
+
+nsec_t OverflowDriver::nextEventTime()
+{
+	return mDriver->nextEventTime();
+}
+
+void OverflowDriver::releaseChannel(int idx)
+{
+	mDriver->releaseChannel(idx);
+}
+
+bool OverflowDriver::releaseLChannel(int lchan)
+{
+	return mDriver->releaseLChannel(lchan);
+}
+
+void OverflowDriver::panic()
+{
+	mDriver->panic();
+}
+
+const std::vector<nsec_t>& OverflowDriver::refused() const
+{
+	return mRefused;
+}
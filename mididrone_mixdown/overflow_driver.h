@@ -0,0 +1,30 @@
+#ifndef OVERFLOW_DRIVER_H_INCLUDED
+#define OVERFLOW_DRIVER_H_INCLUDED
+
+#include <vector>
+#include "driver.h"
+
+/* Driver wrapper keeping the song date of every note the wrapped driver
+ * refused, i.e. when the polyphony exceeded its channel count. */
+class OverflowDriver final : public Driver
+{
+public:
+	/* Takes ownership of driver */
+	OverflowDriver(Driver *driver);
+	virtual ~OverflowDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	const std::vector<nsec_t>& refused() const;
+private:
+	Driver *mDriver;
+	std::vector<nsec_t> mRefused;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "alloc_guard.h"
+
+#ifdef MUSICIAN_ALLOC_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+}
+
+static std::atomic<bool> armed(false);
+
+/* No stdio here, it may allocate itself */
+static void report(const char *str)
+{
+	ssize_t res = write(STDERR_FILENO, str, strlen(str));
+	(void)res;
+}
+
+static void check(const char *what)
+{
+	if (!armed.load(std::memory_order_relaxed))
+		return;
+	armed.store(false);
+	report("alloc_guard: heap allocation in real-time mode: ");
+	report(what);
+	report("\n");
+	abort();
+}
+
+void alloc_guard_arm()
+{
+	armed.store(true);
+}
+
+void alloc_guard_disarm()
+{
+	armed.store(false);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	check("malloc");
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	check("calloc");
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	check("realloc");
+	return __real_realloc(ptr, size);
+}
+
+/* libstdc++ calls malloc() from its own object, out of reach of --wrap */
+void *operator new(size_t size)
+{
+	void *ptr;
+	check("operator new");
+	ptr = __real_malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+#endif
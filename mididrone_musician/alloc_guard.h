@@ -0,0 +1,17 @@
+#ifndef ALLOC_GUARD_H_INCLUDED
+#define ALLOC_GUARD_H_INCLUDED
+
+/* Debug check of the real-time mode: once armed, any heap allocation aborts
+ * the musician. Only built with MUSICIAN_ALLOC_GUARD defined, malloc(),
+ * calloc() and realloc() must then be wrapped at link time
+ * (-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc). Otherwise arming and
+ * disarming do nothing. */
+#ifdef MUSICIAN_ALLOC_GUARD
+void alloc_guard_arm();
+void alloc_guard_disarm();
+#else
+static inline void alloc_guard_arm() {}
+static inline void alloc_guard_disarm() {}
+#endif
+
+#endif
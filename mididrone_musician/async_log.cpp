@@ -0,0 +1,315 @@
+#include "async_log.h"
+#include <sys/types.h>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+
+/* Longest line written for a record, longer ones are truncated */
+#define LOG_LINE_MAX 512
+
+static std::atomic<AsyncLog*> async_log(NULL);
+
+/* Conversion specification: '%', flags, width and precision (prefix_len
+ * characters from start), then length modifier and conversion. */
+struct Spec {
+	const char *start;
+	size_t prefix_len;
+	char length; // 0, 'H' (hh), 'h', 'l', 'q' (ll), 'j', 'z', 't' or 'L'
+	char conv;
+};
+
+/* Parse the conversion specification starting at p, on a '%'. Returns the
+ * character following it, or NULL when the format ends early. */
+static const char *parse_spec(const char *p, struct Spec *spec)
+{
+	spec->start = p++;
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+		p++;
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	spec->prefix_len = (size_t)(p - spec->start);
+
+	spec->length = 0;
+	if (p[0] == 'h' && p[1] == 'h') {
+		spec->length = 'H';
+		p += 2;
+	} else if (p[0] == 'l' && p[1] == 'l') {
+		spec->length = 'q';
+		p += 2;
+	} else {
+		switch (*p) {
+		case 'h': case 'l': case 'j': case 'z': case 't': case 'L':
+			spec->length = *p++;
+			break;
+		}
+	}
+
+	if (!*p)
+		return NULL;
+	spec->conv = *p++;
+	return p;
+}
+
+static bool is_signed_conv(char conv)
+{
+	return conv == 'd' || conv == 'i';
+}
+
+static bool is_unsigned_conv(char conv)
+{
+	return conv == 'u' || conv == 'o' || conv == 'x' || conv == 'X';
+}
+
+static bool is_float_conv(char conv)
+{
+	switch (conv) {
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		return true;
+	default:
+		return false;
+	}
+}
+
+AsyncLog::AsyncLog(FILE *out, nsec_t flush_period) :
+	mOut(out),
+	mFlushPeriod(flush_period),
+	mThread(),
+	mStarted(false),
+	mStop(false),
+	mSlots(new Slot[mNumRecords]),
+	mHead(0),
+	mTail(0),
+	mDropped(0),
+	mWritten(0)
+{
+	for (unsigned int i = 0; i < mNumRecords; i++)
+		mSlots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+AsyncLog::~AsyncLog()
+{
+	if (mStarted) {
+		mStop.store(true);
+		pthread_join(mThread, NULL);
+	}
+	drain();
+	fflush(mOut);
+	delete[] mSlots;
+}
+
+bool AsyncLog::start()
+{
+	int res = pthread_create(&mThread, NULL, threadMain, this);
+	if (res) {
+		printf("Failed to create log thread: %s\n", strerror(res));
+		return false;
+	}
+	mStarted = true;
+	return true;
+}
+
+unsigned long AsyncLog::written() const
+{
+	return mWritten;
+}
+
+unsigned long AsyncLog::dropped() const
+{
+	return mDropped.load(std::memory_order_relaxed);
+}
+
+void AsyncLog::log(const char *fmt, va_list ap)
+{
+	unsigned int pos = mTail.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	/* Reserve a slot */
+	while (1) {
+		slot = &mSlots[pos & (mNumRecords - 1)];
+		int diff = (int)(slot->seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (mTail.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = mTail.load(std::memory_order_relaxed);
+		}
+	}
+
+	Record& record(slot->record);
+	record.fmt = fmt;
+	record.nargs = 0;
+	const char *p = fmt;
+	while (p && (p = strchr(p, '%')) && record.nargs < mMaxArgs) {
+		struct Spec spec;
+		Arg& arg(record.args[record.nargs]);
+		p = parse_spec(p, &spec);
+		if (!p || spec.conv == '%')
+			continue;
+		if (is_signed_conv(spec.conv)) {
+			switch (spec.length) {
+			case 'l': arg.i = va_arg(ap, long); break;
+			case 'q': arg.i = va_arg(ap, long long); break;
+			case 'j': arg.i = va_arg(ap, intmax_t); break;
+			case 'z': arg.i = va_arg(ap, ssize_t); break;
+			case 't': arg.i = va_arg(ap, ptrdiff_t); break;
+			default: arg.i = va_arg(ap, int); break;
+			}
+		} else if (is_unsigned_conv(spec.conv)) {
+			switch (spec.length) {
+			case 'l': arg.u = va_arg(ap, unsigned long); break;
+			case 'q': arg.u = va_arg(ap, unsigned long long); break;
+			case 'j': arg.u = va_arg(ap, uintmax_t); break;
+			case 'z': arg.u = va_arg(ap, size_t); break;
+			case 't': arg.u = va_arg(ap, ptrdiff_t); break;
+			default: arg.u = va_arg(ap, unsigned int); break;
+			}
+		} else if (is_float_conv(spec.conv)) {
+			if (spec.length == 'L')
+				arg.d = (double)va_arg(ap, long double);
+			else
+				arg.d = va_arg(ap, double);
+		} else if (spec.conv == 'c') {
+			arg.i = va_arg(ap, int);
+		} else if (spec.conv == 's' || spec.conv == 'p') {
+			arg.p = va_arg(ap, const void *);
+		} else {
+			break;
+		}
+		record.nargs++;
+	}
+
+	slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void* AsyncLog::threadMain(void *arg)
+{
+	static_cast<AsyncLog*>(arg)->run();
+	return NULL;
+}
+
+void AsyncLog::run()
+{
+	struct timespec period;
+	ns_to_timespec(mFlushPeriod, &period);
+	while (!mStop.load()) {
+		if (drain())
+			fflush(mOut);
+		while (nanosleep(&period, &period) == -1 && errno == EINTR)
+			;
+		ns_to_timespec(mFlushPeriod, &period);
+	}
+}
+
+/* Write out the ready records, returns how many */
+unsigned int AsyncLog::drain()
+{
+	unsigned int count = 0;
+	while (1) {
+		Slot *slot = &mSlots[mHead & (mNumRecords - 1)];
+		if (slot->seq.load(std::memory_order_acquire) != mHead + 1)
+			break;
+		write(slot->record);
+		slot->seq.store(mHead + mNumRecords, std::memory_order_release);
+		mHead++;
+		count++;
+	}
+	mWritten += count;
+	return count;
+}
+
+/* Format a record as printf() would have, one conversion at a time.
+ * Integers are widened to long long when recorded, so their conversions
+ * are rebuilt with an ll length modifier. */
+void AsyncLog::write(const Record& record)
+{
+	char line[LOG_LINE_MAX];
+	size_t len = 0;
+	int argi = 0;
+	const char *p = record.fmt;
+
+	while (*p && len < sizeof(line) - 1) {
+		struct Spec spec;
+		char conv[32];
+		const char *next;
+		int res = 0;
+
+		if (*p != '%') {
+			line[len++] = *p++;
+			continue;
+		}
+		next = parse_spec(p, &spec);
+		if (next && spec.conv == '%') {
+			line[len++] = '%';
+			p = next;
+			continue;
+		}
+		if (!next || argi >= record.nargs ||
+		    spec.prefix_len + 4 > sizeof(conv)) {
+			/* Unsupported: keep the rest of the format as is */
+			res = snprintf(line + len, sizeof(line) - len, "%s", p);
+			len += res > 0 ? (size_t)res : 0;
+			break;
+		}
+
+		const Arg& arg(record.args[argi++]);
+		memcpy(conv, spec.start, spec.prefix_len);
+		size_t clen = spec.prefix_len;
+		if (is_signed_conv(spec.conv) || is_unsigned_conv(spec.conv)) {
+			conv[clen++] = 'l';
+			conv[clen++] = 'l';
+		}
+		conv[clen++] = spec.conv;
+		conv[clen] = '\0';
+
+		if (is_signed_conv(spec.conv))
+			res = snprintf(line + len, sizeof(line) - len, conv,
+					arg.i);
+		else if (spec.conv == 'c')
+			res = snprintf(line + len, sizeof(line) - len, conv,
+					(int)arg.i);
+		else if (is_unsigned_conv(spec.conv))
+			res = snprintf(line + len, sizeof(line) - len, conv,
+					arg.u);
+		else if (is_float_conv(spec.conv))
+			res = snprintf(line + len, sizeof(line) - len, conv,
+					arg.d);
+		else
+			res = snprintf(line + len, sizeof(line) - len, conv,
+					arg.p);
+		if (res > 0)
+			len += (size_t)res;
+		p = next;
+	}
+	if (len > sizeof(line) - 1)
+		len = sizeof(line) - 1;
+	fwrite(line, 1, len, mOut);
+}
+
+void log_printf(const char *fmt, ...)
+{
+	va_list ap;
+	AsyncLog *log = async_log.load(std::memory_order_acquire);
+
+	va_start(ap, fmt);
+	if (log)
+		log->log(fmt, ap);
+	else
+		vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void log_set_async(AsyncLog *log)
+{
+	async_log.store(log, std::memory_order_release);
+}
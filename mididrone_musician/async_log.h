@@ -0,0 +1,78 @@
+#ifndef ASYNC_LOG_H_INCLUDED
+#define ASYNC_LOG_H_INCLUDED
+
+#include <pthread.h>
+#include <cstdarg>
+#include <cstdio>
+#include <atomic>
+#include "timeline.h"
+
+/* Deferred printf() for the playback path.
+ * log() only parses the format to pick its arguments up, and copies the
+ * format pointer and the raw arguments into a fixed-size record of a
+ * bounded lock-free ring, which any thread may write to. A background
+ * thread formats the records and writes them out every flush period.
+ * When the ring is full, records are dropped and counted.
+ * Formats are not copied: they must be string literals, and so must the
+ * strings passed to %s. '*' widths and precisions and %n are not
+ * supported. */
+class AsyncLog
+{
+public:
+	AsyncLog(FILE *out, nsec_t flush_period);
+	/* Stops the background thread and writes the pending records */
+	~AsyncLog();
+	bool start();
+	void log(const char *fmt, va_list ap);
+	unsigned long written() const;
+	unsigned long dropped() const;
+private:
+	static const unsigned int mNumRecords = 2048;
+	static const int mMaxArgs = 8;
+
+	union Arg {
+		long long i;
+		unsigned long long u;
+		double d;
+		const void *p;
+	};
+
+	struct Record {
+		const char *fmt;
+		int nargs;
+		Arg args[mMaxArgs];
+	};
+
+	/* A record slot is free for the producer reserving position pos when
+	 * its sequence is pos, and ready for the consumer when it is
+	 * pos + 1. */
+	struct Slot {
+		std::atomic<unsigned int> seq;
+		Record record;
+	};
+
+	static void* threadMain(void *arg);
+	void run();
+	unsigned int drain();
+	void write(const Record& record);
+
+	FILE *mOut;
+	nsec_t mFlushPeriod;
+	pthread_t mThread;
+	bool mStarted;
+	std::atomic<bool> mStop;
+	Slot *mSlots;
+	/* Consumer position, only used by the background thread */
+	unsigned int mHead;
+	char mPad[64];
+	std::atomic<unsigned int> mTail;
+	std::atomic<unsigned long> mDropped;
+	unsigned long mWritten;
+};
+
+/* printf() replacement: goes through the given log once set, and straight
+ * to printf() otherwise, or again after setting NULL. */
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_set_async(AsyncLog *log);
+
+#endif
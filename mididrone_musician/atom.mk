@@ -5,13 +5,34 @@ LOCAL_MODULE := mididrone_musician
 LOCAL_CATEGORY_PATH := mididrone
 LOCAL_DESCRIPTION := Play a MIDI file on the drone, receiving instructions from the conductor
 LOCAL_SRC_FILES := \
+	alloc_guard.cpp \
+	async_log.cpp \
+	conductor_listener.cpp \
+	feed_driver.cpp \
 	mididrone_musician.cpp \
-	stdout_driver.cpp
+	onset_driver.cpp \
+	recording_driver.cpp \
+	render_driver.cpp \
+	scheduler.cpp \
+	score.cpp \
+	stdout_driver.cpp \
+	sync_filter.cpp \
+	sysfs_pwm_driver.cpp \
+	telemetry.cpp \
+	threaded_driver.cpp
 
-LOCAL_LIBRARIES := portsmf libpomp libfutils
+LOCAL_LIBRARIES := portsmf libpomp libfutils libmididrone_trace \
+	libmididrone_render libmididrone_feed libmididrone_proto
 LOCAL_FORCE_STATIC := 1
 LOCAL_CFLAGS := -std=gnu99
 LOCAL_CXXFLAGS := -std=c++0x
+LOCAL_LDLIBS := -lpthread
+
+# Debug builds only: abort on any heap allocation in real-time mode (-R)
+ifeq ("$(MIDIDRONE_ALLOC_GUARD)","1")
+LOCAL_CXXFLAGS += -DMUSICIAN_ALLOC_GUARD
+LOCAL_LDFLAGS += -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+endif
 
 ifeq ("$(TARGET_CPU)","p6i")
 LOCAL_DEPENDS_HEADERS := linux
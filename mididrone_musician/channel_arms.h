@@ -0,0 +1,116 @@
+#ifndef CHANNEL_ARMS_H_INCLUDED
+#define CHANNEL_ARMS_H_INCLUDED
+
+#include "driver.h"
+
+/* Bookkeeping of the channels reserved by Driver::armNote(), for the
+ * drivers implementing it: a channel is armed for the note starting at a
+ * date on a logical channel and frequency, and stays free until addNote()
+ * starts that note on it. How a channel is set up is up to the driver. */
+class ChannelArms
+{
+public:
+	explicit ChannelArms(int channels) :
+		mNumChans(channels),
+		mArms(new Arm[channels]())
+	{
+	}
+
+	~ChannelArms()
+	{
+		delete[] mArms;
+	}
+
+	ChannelArms(const ChannelArms&) = delete;
+	ChannelArms& operator=(const ChannelArms&) = delete;
+
+	/* For addNote(): the free channel armed for the note, else a free one
+	 * nobody armed, else one armed for another note. Returns -1 when all
+	 * are busy, armed tells whether the channel was armed for the note. */
+	int pick(const ChannelState *chans, int lchannel, int freq,
+			bool *armed) const
+	{
+		int idx = -1;
+
+		for (int i = 0; i < mNumChans; ++i) {
+			if (chans[i].busy)
+				continue;
+			if (mArms[i].armed && mArms[i].lchannel == lchannel &&
+					mArms[i].freq == freq) {
+				*armed = true;
+				return i;
+			}
+			if (idx < 0 || (mArms[idx].armed && !mArms[i].armed))
+				idx = i;
+		}
+		*armed = false;
+		return idx;
+	}
+
+	/* For armNote(): a free channel nobody armed, the last one prefer(i)
+	 * holds for if any, e.g. already at the frequency of the note.
+	 * Returns -1 when there is none left, or when one is armed for the
+	 * note already, which done tells. */
+	template <class Pred>
+	int pickFree(const ChannelState *chans, nsec_t starttime,
+			int lchannel, int freq, bool *done, Pred prefer) const
+	{
+		int idx = -1;
+
+		*done = false;
+		for (int i = 0; i < mNumChans; ++i) {
+			if (chans[i].busy)
+				continue;
+			if (mArms[i].armed) {
+				if (mArms[i].starttime == starttime &&
+						mArms[i].lchannel == lchannel &&
+						mArms[i].freq == freq) {
+					*done = true;
+					return -1;
+				}
+				continue;
+			}
+			if (idx < 0 || prefer(i))
+				idx = i;
+		}
+		return idx;
+	}
+
+	void arm(int idx, nsec_t starttime, int lchannel, int freq)
+	{
+		mArms[idx].armed = true;
+		mArms[idx].starttime = starttime;
+		mArms[idx].lchannel = lchannel;
+		mArms[idx].freq = freq;
+	}
+
+	/* A note starting at starttime took channel idx. Arms for notes
+	 * which should have started by now were missed, e.g. dropped late. */
+	void noteStarted(int idx, nsec_t starttime)
+	{
+		mArms[idx].armed = false;
+		for (int i = 0; i < mNumChans; ++i) {
+			if (mArms[i].armed && mArms[i].starttime < starttime)
+				mArms[i].armed = false;
+		}
+	}
+
+	void clear()
+	{
+		for (int i = 0; i < mNumChans; ++i)
+			mArms[i].armed = false;
+	}
+
+private:
+	struct Arm {
+		bool armed;
+		nsec_t starttime;
+		int lchannel;
+		int freq;
+	};
+
+	int mNumChans;
+	Arm *mArms;
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "conductor_listener.h"
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <probes.h>
+#include <proto.h>
+#include <futils/futils.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include "async_log.h"
+
+ConductorListener::ConductorListener(struct pomp_loop *loop,
+		SyncFilter::Method method, unsigned int window,
+		const Callbacks& cbs, void *userdata) :
+	mLoop(loop),
+	mFilter(method, window),
+	mCbs(cbs),
+	mUserdata(userdata),
+	mSock(-1),
+	mStartTimer(-1),
+	mStarted(false),
+	mOffset(0),
+	mStartArmed(false),
+	mStartOffset(0),
+	mStartDate()
+{
+}
+
+ConductorListener::~ConductorListener()
+{
+	if (mSock != -1) {
+		pomp_loop_remove(mLoop, mSock);
+		close(mSock);
+	}
+	if (mStartTimer != -1) {
+		pomp_loop_remove(mLoop, mStartTimer);
+		close(mStartTimer);
+	}
+}
+
+bool ConductorListener::start(unsigned int port, const struct in_addr *group,
+		const struct in_addr *ifaddr)
+{
+	return setupSocket(port, group, ifaddr) && setupStartTimer();
+}
+
+int ConductorListener::fd() const
+{
+	return mSock;
+}
+
+bool ConductorListener::started() const
+{
+	return mStarted;
+}
+
+/* Unicast and broadcast keep working when a multicast group is joined as
+ * well. */
+bool ConductorListener::setupSocket(unsigned int port,
+		const struct in_addr *group, const struct in_addr *ifaddr)
+{
+	int res;
+	int reuse = 1;
+	int timestamps = 1;
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+
+	mSock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (mSock == -1) {
+		printf("socket() failed: %s\n", strerror(errno));
+		return false;
+	}
+	if (group->s_addr != htonl(INADDR_ANY)) {
+		/* Several musicians of the same host may join the group */
+		res = setsockopt(mSock, SOL_SOCKET, SO_REUSEADDR, &reuse,
+				sizeof(reuse));
+		if (res == -1) {
+			printf("setsockopt(SO_REUSEADDR) failed: %s\n",
+					strerror(errno));
+			goto error;
+		}
+	}
+	res = setsockopt(mSock, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps,
+			sizeof(timestamps));
+	if (res == -1) {
+		/* Receive dates fall back to the wakeup date */
+		printf("setsockopt(SO_TIMESTAMPNS) failed: %s\n",
+				strerror(errno));
+	}
+	res = bind(mSock, (const struct sockaddr*)&addr, sizeof(addr));
+	if (res == -1) {
+		printf("bind() failed: %s\n", strerror(errno));
+		goto error;
+	}
+	if (group->s_addr != htonl(INADDR_ANY)) {
+		struct ip_mreq mreq;
+		mreq.imr_multiaddr = *group;
+		mreq.imr_interface = *ifaddr;
+		res = setsockopt(mSock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+				sizeof(mreq));
+		if (res == -1) {
+			printf("IP_ADD_MEMBERSHIP failed: %s\n",
+					strerror(errno));
+			goto error;
+		}
+		printf("Joined multicast group %s\n", inet_ntoa(*group));
+	}
+
+	res = pomp_loop_add(mLoop, mSock, POMP_FD_EVENT_IN, socketCb, this);
+	if (res) {
+		printf("pomp_loop_add() failed: %s\n", strerror(-res));
+		goto error;
+	}
+	return true;
+
+error:
+	close(mSock);
+	mSock = -1;
+	return false;
+}
+
+bool ConductorListener::setupStartTimer()
+{
+	int res;
+
+	mStartTimer = timerfd_create(CLOCK_MONOTONIC,
+			TFD_CLOEXEC | TFD_NONBLOCK);
+	if (mStartTimer == -1) {
+		printf("timerfd_create() failed: %s\n", strerror(errno));
+		return false;
+	}
+	res = pomp_loop_add(mLoop, mStartTimer, POMP_FD_EVENT_IN,
+			startTimerCb, this);
+	if (res) {
+		printf("pomp_loop_add() failed: %s\n", strerror(-res));
+		close(mStartTimer);
+		mStartTimer = -1;
+		return false;
+	}
+	return true;
+}
+
+void ConductorListener::socketCb(int fd, uint32_t revents, void *userdata)
+{
+	ConductorListener *self = static_cast<ConductorListener*>(userdata);
+
+	if (revents & POMP_FD_EVENT_IN)
+		self->receive();
+	if (revents & (POMP_FD_EVENT_ERR | POMP_FD_EVENT_HUP)) {
+		printf("ERR or HUP event.\n");
+		self->mCbs.failed(self->mUserdata);
+	}
+}
+
+void ConductorListener::startTimerCb(int fd, uint32_t revents,
+		void *userdata)
+{
+	ConductorListener *self = static_cast<ConductorListener*>(userdata);
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) == -1) {
+		if (errno != EAGAIN)
+			printf("read() failed: %s\n", strerror(errno));
+		return;
+	}
+	if (self->mStarted)
+		return;
+	printf("Scheduled start reached\n");
+	self->go(&self->mStartDate);
+}
+
+/* Drain the socket in batches */
+void ConductorListener::receive()
+{
+	int res;
+	bool corrected = false;
+	uint32_t bufs[mBatch][sizeof(struct start_msg) / 4 + 1];
+	char ctrl[mBatch][CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_in saddrs[mBatch];
+	struct iovec iovs[mBatch];
+	struct mmsghdr msgs[mBatch];
+
+	do {
+		struct timespec now_mono, now_real;
+
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < mBatch; i++) {
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = sizeof(bufs[i]);
+			msgs[i].msg_hdr.msg_name = &saddrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(saddrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+		}
+
+		res = recvmmsg(mSock, msgs, mBatch, MSG_DONTWAIT, NULL);
+		if (res == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			printf("recvmmsg() failed: %s\n", strerror(errno));
+			mCbs.failed(mUserdata);
+			return;
+		}
+
+		/* Kernel dates are on CLOCK_REALTIME */
+		time_get_monotonic(&now_mono);
+		clock_gettime(CLOCK_REALTIME, &now_real);
+		for (int i = 0; i < res; i++) {
+			nsec_t rx = timespec_to_ns(&now_mono);
+			struct cmsghdr *cmsg;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+					cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				struct timespec kts;
+				if (cmsg->cmsg_level != SOL_SOCKET ||
+				    cmsg->cmsg_type != SCM_TIMESTAMPNS)
+					continue;
+				memcpy(&kts, CMSG_DATA(cmsg), sizeof(kts));
+				rx -= timespec_to_ns(&now_real) -
+					timespec_to_ns(&kts);
+			}
+			if (handle(bufs[i], msgs[i].msg_len, &saddrs[i], rx))
+				corrected = true;
+		}
+	} while (res == mBatch);
+
+	if (corrected)
+		mCbs.corrected(mFilter.value(), mUserdata);
+}
+
+/* Handle one packet, received at local monotonic date rx. Returns true
+ * when the clock error changed. */
+bool ConductorListener::handle(const void *data, int len,
+		const struct sockaddr_in *saddr, nsec_t rx)
+{
+	uint32_t new_ts;
+
+	if (len == sizeof(struct start_msg)) {
+		const struct start_msg *msg =
+			static_cast<const struct start_msg*>(data);
+		if (ntohl(msg->magic) != START_MAGIC)
+			return false;
+		if (mCbs.heard)
+			mCbs.heard(saddr, mUserdata);
+		if (!mStarted)
+			handleStart(msg, rx);
+		return false;
+	}
+	if (len != sizeof(new_ts))
+		return false;
+
+	if (mCbs.heard)
+		mCbs.heard(saddr, mUserdata);
+	memcpy(&new_ts, data, sizeof(new_ts));
+	new_ts = ntohl(new_ts);
+	/* When a start is scheduled, the initial timestamp only means
+	 * the conductor reached it: keep the armed date. */
+	if (new_ts == 0 && mStartArmed)
+		return false;
+	if (!mStarted && new_ts == 0) {
+		struct timespec start;
+		printf("Go received from %s:%d\n", inet_ntoa(saddr->sin_addr),
+				ntohs(saddr->sin_port));
+		ns_to_timespec(rx, &start);
+		go(&start);
+	} else if (mStarted) {
+		nsec_t local_ts = rx - mOffset;
+		nsec_t sample = (nsec_t)new_ts * NSEC_PER_SEC - local_ts;
+		nsec_t error;
+
+		mFilter.addSample(sample);
+		error = mFilter.value();
+		MIDIDRONE_PROBE3(clock_correction, new_ts, sample, error);
+
+		log_printf("Conductor timestamp: %u Local: %.4f Sample: %.6f "
+				"Error: %4f\n", new_ts, ns_to_sec(local_ts),
+				ns_to_sec(sample), ns_to_sec(error));
+		return true;
+	}
+	return false;
+}
+
+/* Refine the local start date with a new announcement, and (re)arm the
+ * start timer on it. */
+void ConductorListener::handleStart(const struct start_msg *msg, nsec_t rx)
+{
+	struct itimerspec spec;
+	nsec_t conductor_now, conductor_start, offset;
+	int res;
+
+	conductor_now = (nsec_t)ntohl(msg->now_sec) * NSEC_PER_SEC +
+		ntohl(msg->now_nsec);
+	conductor_start = (nsec_t)ntohl(msg->start_sec) * NSEC_PER_SEC +
+		ntohl(msg->start_nsec);
+
+	/* Network and scheduling delays only make the offset smaller */
+	offset = conductor_now - rx;
+	if (mStartArmed && offset <= mStartOffset)
+		return;
+	mStartOffset = offset;
+	mStartArmed = true;
+	ns_to_timespec(conductor_start - mStartOffset, &mStartDate);
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value = mStartDate;
+	res = timerfd_settime(mStartTimer, TFD_TIMER_ABSTIME, &spec, NULL);
+	if (res == -1) {
+		printf("Failed to arm start timer: %s\n", strerror(errno));
+		return;
+	}
+	log_printf("Start in %.4f s\n",
+			ns_to_sec(conductor_start - conductor_now));
+}
+
+void ConductorListener::go(const struct timespec *start)
+{
+	mStarted = true;
+	mOffset = timespec_to_ns(start);
+	/* The start itself is the first offset sample */
+	mFilter.addSample(0);
+	mCbs.go(start, mUserdata);
+}
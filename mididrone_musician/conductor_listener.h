@@ -0,0 +1,73 @@
+#ifndef CONDUCTOR_LISTENER_H_INCLUDED
+#define CONDUCTOR_LISTENER_H_INCLUDED
+
+#include <time.h>
+#include <netinet/in.h>
+#include <libpomp.h>
+#include "timeline.h"
+#include "sync_filter.h"
+
+struct start_msg;
+
+/* Receiving end of the conductor protocol, see proto.h: Go, scheduled
+ * start and clock offset samples.
+ * The socket is drained in batches, and receive dates come from the
+ * kernel (SO_TIMESTAMPNS), so that our own wakeup latency does not end up
+ * in the clock correction. Start announcements refine the local start
+ * date, which a timer fires on. */
+class ConductorListener
+{
+public:
+	struct Callbacks {
+		/* The song starts at the CLOCK_MONOTONIC date start */
+		void (*go)(const struct timespec *start, void *userdata);
+		/* The filtered clock error changed, after a batch of packets */
+		void (*corrected)(nsec_t error, void *userdata);
+		/* A packet came from the conductor at addr, may be NULL */
+		void (*heard)(const struct sockaddr_in *addr, void *userdata);
+		/* The socket failed, nothing more will be received */
+		void (*failed)(void *userdata);
+	};
+
+	ConductorListener(struct pomp_loop *loop, SyncFilter::Method method,
+			unsigned int window, const Callbacks& cbs,
+			void *userdata);
+	~ConductorListener();
+	/* Listen on INADDR_ANY:port, joining group as well unless it is
+	 * INADDR_ANY */
+	bool start(unsigned int port, const struct in_addr *group,
+			const struct in_addr *ifaddr);
+	int fd() const;
+	bool started() const;
+private:
+	/* Max packets read from the socket in one system call */
+	static const int mBatch = 8;
+
+	static void socketCb(int fd, uint32_t revents, void *userdata);
+	static void startTimerCb(int fd, uint32_t revents, void *userdata);
+	bool setupSocket(unsigned int port, const struct in_addr *group,
+			const struct in_addr *ifaddr);
+	bool setupStartTimer();
+	void receive();
+	bool handle(const void *data, int len, const struct sockaddr_in *saddr,
+			nsec_t rx);
+	void handleStart(const struct start_msg *msg, nsec_t rx);
+	void go(const struct timespec *start);
+
+	struct pomp_loop *mLoop;
+	SyncFilter mFilter;
+	Callbacks mCbs;
+	void *mUserdata;
+	int mSock;
+	int mStartTimer;
+	bool mStarted;
+	/* CLOCK_MONOTONIC date of the song start */
+	nsec_t mOffset;
+	/* Scheduled start: conductor clock minus local clock, taken from the
+	 * least delayed announcement, and the resulting local start date. */
+	bool mStartArmed;
+	nsec_t mStartOffset;
+	struct timespec mStartDate;
+};
+
+#endif
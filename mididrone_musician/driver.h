@@ -1,6 +1,12 @@
 #ifndef DRIVER_H_INCLUDED
 #define DRIVER_H_INCLUDED
 
+#include "timeline.h"
+
+/* Channel ratio at a 100% duty cycle: the output is high for
+ * ratio / DRIVER_RATIO_MAX of each period */
+#define DRIVER_RATIO_MAX 256
+
 struct ChannelState
 {
 public:
@@ -8,20 +14,30 @@ public:
 	int lchannel; // Logical channel
 	int freq;
 	int ratio;
-	double stoptime;
+	nsec_t stoptime;
 };
 
 class Driver {
 public:
 	virtual ~Driver() {};
 	virtual int channels() = 0;
-	virtual bool addNote(double ts, double starttime, int lchannel,
-			int freq, int ratio, double duration) = 0;
-	virtual void update(double ts) = 0;
-	virtual double nextEventTime() = 0;
+	virtual ChannelState channelState(int idx) = 0;
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration) = 0;
+	virtual void update(nsec_t ts) = 0;
+	/* Date of the next release, or -1 when all channels are free */
+	virtual nsec_t nextEventTime() = 0;
 	virtual void releaseChannel(int idx) = 0;
 	virtual bool releaseLChannel(int lchan) = 0;
 	virtual void panic() = 0;
+	/* Hint that a note starts at starttime: a driver where starting a
+	 * channel takes several hardware calls may reserve a free channel
+	 * for it and set it up ahead, silent. Returns true when it did, or
+	 * already had. The note is still started by addNote(). */
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq) { return false; }
+	/* Hardware calls which failed so far */
+	virtual unsigned long errors() { return 0; }
 };
 
 #endif
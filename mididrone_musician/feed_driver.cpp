@@ -0,0 +1,109 @@
+#include "feed_driver.h"
+#include <algorithm>
+
+FeedDriver::FeedDriver(Driver *driver, struct feed_writer *writer) :
+	mDriver(driver),
+	mWriter(writer),
+	mNumChans(std::min(driver->channels(), FEED_MAX_CHANNELS))
+{
+	publish(0);
+}
+
+FeedDriver::~FeedDriver()
+{
+	feed_writer_destroy(mWriter);
+	delete mDriver;
+}
+
+void FeedDriver::publish(nsec_t ts)
+{
+	struct feed_snapshot *snapshot = feed_writer_snapshot(mWriter);
+
+	if (ts >= 0)
+		snapshot->song_time = ts;
+	for (int i = 0; i < mNumChans; i++) {
+		ChannelState state(mDriver->channelState(i));
+		struct feed_channel& chan(snapshot->chans[i]);
+		chan.busy = state.busy;
+		chan.lchannel = state.busy ? state.lchannel : -1;
+		chan.freq = state.freq;
+		chan.ratio = state.ratio;
+		chan.stoptime = state.stoptime;
+	}
+	feed_writer_publish(mWriter);
+}
+
+/* A channel busy in the last snapshot is free now */
+bool FeedDriver::released()
+{
+	const struct feed_snapshot *snapshot = feed_writer_snapshot(mWriter);
+
+	for (int i = 0; i < mNumChans; i++) {
+		if (snapshot->chans[i].busy && !mDriver->channelState(i).busy)
+			return true;
+	}
+	return false;
+}
+
+int FeedDriver::channels()
+{
+	return mDriver->channels();
+}
+
+ChannelState FeedDriver::channelState(int idx)
+{
+	return mDriver->channelState(idx);
+}
+
+bool FeedDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel, int freq,
+		int ratio, nsec_t duration)
+{
+	bool res = mDriver->addNote(ts, starttime, lchannel, freq, ratio,
+			duration);
+	publish(ts);
+	return res;
+}
+
+/* Most updates release nothing: then the last snapshot still holds */
+void FeedDriver::update(nsec_t ts)
+{
+	mDriver->update(ts);
+	if (released())
+		publish(ts);
+}
+
+nsec_t FeedDriver::nextEventTime()
+{
+	return mDriver->nextEventTime();
+}
+
+void FeedDriver::releaseChannel(int idx)
+{
+	mDriver->releaseChannel(idx);
+	publish(-1);
+}
+
+bool FeedDriver::releaseLChannel(int lchan)
+{
+	bool res = mDriver->releaseLChannel(lchan);
+	publish(-1);
+	return res;
+}
+
+void FeedDriver::panic()
+{
+	mDriver->panic();
+	publish(-1);
+}
+
+/* An armed channel is still free: nothing to publish */
+bool FeedDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq)
+{
+	return mDriver->armNote(ts, starttime, lchannel, freq);
+}
+
+unsigned long FeedDriver::errors()
+{
+	return mDriver->errors();
+}
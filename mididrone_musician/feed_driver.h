@@ -0,0 +1,39 @@
+#ifndef FEED_DRIVER_H_INCLUDED
+#define FEED_DRIVER_H_INCLUDED
+
+#include <feed.h>
+#include "driver.h"
+
+/* Driver wrapper publishing the channel states of the wrapped driver and
+ * the song date of the call into a shared memory feed (see
+ * libmididrone_feed) after every call changing them. Publishing is a copy
+ * into the mapped segment: it never waits for the readers. */
+class FeedDriver : public Driver
+{
+public:
+	/* Takes ownership of driver and writer */
+	FeedDriver(Driver *driver, struct feed_writer *writer);
+	virtual ~FeedDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
+private:
+	/* Release calls carry no date: they keep the last one */
+	void publish(nsec_t ts);
+	bool released();
+
+	Driver *mDriver;
+	struct feed_writer *mWriter;
+	int mNumChans;
+};
+
+#endif
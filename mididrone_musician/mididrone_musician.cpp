@@ -1,303 +1,867 @@
 #include <math.h>
+#include <getopt.h>
 #include <libgen.h>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <libpomp.h>
+#include <probes.h>
 #include <futils/futils.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <vector>
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <cstdio>
-#include <allegro.h>
+#include "score.h"
+#include "scheduler.h"
 #include "driver.h"
 #include "stdout_driver.h"
 #include "pwm_driver.h"
+#include "sysfs_pwm_driver.h"
+#include "threaded_driver.h"
+#include "onset_driver.h"
+#include "recording_driver.h"
+#include "feed_driver.h"
+#include "render_driver.h"
+#include "sync_filter.h"
+#include "conductor_listener.h"
+#include "alloc_guard.h"
+#include "async_log.h"
+#include "telemetry.h"
+
+#define CONDUCTOR_PORT 5555
+/* Records buffered by the driver call trace between two writes */
+#define TRACE_BUFFER_RECORDS 16384
+/* Channels of the render driver, as many as the drone's motors */
+#define RENDER_CHANNELS 4
+/* Channels of the sysfs PWM driver, likewise */
+#define SYSFS_PWM_CHANNELS 4
+/* Period at which the playback log is written out */
+#define LOG_FLUSH_PERIOD (20 * NSEC_PER_MSEC)
+/* Default period of the status reports to the conductor */
+#define STATUS_PERIOD_MS 1000
+
+/* Stack touched up front in real-time mode, so that it is resident */
+#define RT_STACK_PREFAULT (256 * 1024)
 
 #define ROUND(x) (int) ((x)+0.5)
 
 static sig_atomic_t quit = 0;
 
-static bool go_received = false;
-static double time_sec_offset = 0.0;
-static double time_error = 0.0;
+struct opts {
+	bool ok;
+	bool fast_forward;
+	bool output_thread;
+	bool realtime;
+	bool replay;
+	bool arm;
+	int output_prio;
+	int output_cpu;
+	unsigned int lead_ms;
+	unsigned int port;
+	struct in_addr group;
+	struct in_addr ifaddr;
+	const char* onset_file;
+	const char* trace_file;
+	const char* render_file;
+	const char* feed_name;
+	const char* pwm_chip;
+	SyncFilter::Method sync_method;
+	unsigned int sync_window;
+	int late_ms;
+	unsigned int late_burst;
+	unsigned int slack_us;
+	unsigned int status_ms;
+	const char* filename;
+};
+
+static bool realtime = false;
+/* CLOCK_MONOTONIC date of the song start */
+static nsec_t time_offset = 0;
+static nsec_t time_error = 0;
+/* How far ahead of the current time events are handed to the driver. */
+static nsec_t schedule_lead = 0;
+/* Song date the scheduler timer was last armed for */
+static nsec_t sched_deadline = 0;
 
 static struct pomp_loop *loop = NULL;
-static struct pomp_timer *timer = NULL;
-static int conductor_sock = -1;
+static int sched_timer = -1;
 
-static Alg_seq* seq = NULL;
-static Alg_iterator* seq_iter = NULL;
-static Alg_event* next_event = NULL;
+static ConductorListener* listener = NULL;
+
+static Score score;
 static Driver* driver = NULL;
+static Scheduler* scheduler = NULL;
+static AsyncLog* playback_log = NULL;
+static Telemetry* telemetry = NULL;
 
-static void init_time()
+static nsec_t get_time()
 {
 	struct timespec ts;
 	time_get_monotonic(&ts);
-	time_sec_offset = (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+	return timespec_to_ns(&ts) - time_offset + time_error;
 }
 
-static double get_time()
+/* Absolute CLOCK_MONOTONIC date at which the song reaches ts */
+static void song_time_to_deadline(nsec_t ts, struct timespec *deadline)
 {
-	struct timespec ts;
-	double res;
-	time_get_monotonic(&ts);
-	res = (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
-	res -= time_sec_offset;
-	res += time_error;
-	return res;
+	ns_to_timespec(ts - time_error + time_offset, deadline);
 }
 
-static void wait_until(double time)
+/* Wake up when the song, schedule lead included, reaches ts */
+static void arm_sched_timer(nsec_t ts)
 {
-	double now;
-	do {
-		now = get_time();
-		//printf("now: %f\n", now);
-		if (time - now >= 1.0)
-			sleep((int)(time - now));
-		else if (time - now > 0.0)
-			usleep((time - now) * 1000000.0);
-	} while (now < time);
+	struct itimerspec spec;
+
+	MIDIDRONE_PROBE2(timer_arm, ts, schedule_lead);
+	sched_deadline = ts;
+	memset(&spec, 0, sizeof(spec));
+	song_time_to_deadline(ts - schedule_lead, &spec.it_value);
+	/* A zero date would disarm the timer */
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+	if (timerfd_settime(sched_timer, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+		printf("Failed to arm scheduler timer: %s\n", strerror(errno));
 }
 
-static int key2freq(int key)
+static void send_status(bool ended)
 {
-	double freq = pow(2.0, ((double)key - 69.0) / 12.0) * 440.0;
-	//printf("key2freq: %i -> %i\n", key, (int)round(freq));
-	return (int)round(freq);
+	const Scheduler::Stats& stats(scheduler->stats());
+	Telemetry::Status status;
+
+	status.ended = ended;
+	status.position = get_time();
+	status.offset = time_error;
+	status.events = stats.events;
+	status.dropped = stats.lateExpired + stats.lateLimited + stats.refused;
+	status.errors = driver->errors();
+	telemetry->send(status);
 }
 
-static int loud2ratio(int loud)
+/* Scheduler control: the report goes after the notes and releases due
+ * along with it, then comes back a period later while the song goes on. */
+static void status_control(nsec_t ts, void *userdata)
 {
-	return loud * 2;
+	send_status(false);
+	if (scheduler->nextDeadline() >= 0)
+		scheduler->addControl(ts + telemetry->period(), status_control,
+				NULL);
 }
 
-static void midi_note_on(Driver *driver, double ts, double starttime, int chan,
-		int key, int loud, double duration)
+static void process_and_schedule(nsec_t ts)
 {
-	chan = chan & 15;
-	if (key > 127) key = 127;
-	if (key < 0) key = 0;
-	if (loud > 127) loud = 127;
-	if (loud < 0) loud = 0;
-
-	int freq = key2freq(key);
-	int ratio = loud2ratio(loud);
-	driver->addNote(ts, starttime, chan, freq, ratio, duration);
+	nsec_t next = scheduler->process(ts);
+	if (next < 0) {
+		/* No more events, end of song */
+		quit = 1;
+		pomp_loop_wakeup(loop);
+		return;
+	}
+	arm_sched_timer(next);
 }
 
-static void process_one_seq_event(double ts)
+static double elapsed_sec(const struct timespec *start)
 {
-	assert(next_event != NULL);
-	// Process notes here
-	if (next_event->is_note()) {
-		midi_note_on(driver, ts, next_event->time, next_event->chan,
-				next_event->get_identifier(),
-				(int) next_event->get_loud(),
-				next_event->get_duration());
-	}
+	struct timespec now;
+	time_get_monotonic(&now);
+	return (double)(now.tv_sec - start->tv_sec) +
+		(double)(now.tv_nsec - start->tv_nsec) / 1000000000.0;
 }
 
-static void process_seq_event(double ts)
+/* Play the whole song against a virtual clock, jumping straight to each
+ * wakeup the timer would have had. Driver output is a deterministic
+ * function of the song, the report goes to stderr. */
+static void fast_forward(void)
 {
-	while(next_event && ts >= next_event->time) {
-		process_one_seq_event(ts);
-		next_event = seq_iter->next();
+	struct timespec start;
+	nsec_t ts = 0;
+	double wall;
+
+	time_get_monotonic(&start);
+	while (!quit) {
+		nsec_t next = scheduler->process(ts);
+		if (next < 0)
+			break;
+		ts = next;
 	}
+	wall = elapsed_sec(&start);
+	if (wall <= 0.0)
+		wall = 1e-9;
+
+	fprintf(stderr, "Fast-forward: %.3f s of song in %.6f s (x%.0f)\n",
+			ns_to_sec(ts), wall, ns_to_sec(ts) / wall);
+	const Scheduler::Stats& stats(scheduler->stats());
+	fprintf(stderr, "  %lu events (%.0f/s), %lu driver calls (%.0f/s), "
+			"%lu wakeups (%.0f/s), %lu coalesced\n",
+			stats.events, stats.events / wall,
+			stats.driverCalls, stats.driverCalls / wall,
+			stats.wakeups, stats.wakeups / wall, stats.coalesced);
 }
 
-static void schedule_timer(double ts)
+static void sig_handler(int sig)
 {
-	long delay_min = -1;
-	/* Determine time to next seq event. */
-	if (next_event) {
-		long next_evt_delay = (next_event->time - ts) * 1000.0;
-		if (next_evt_delay <= 0)
-			next_evt_delay = 1;
-		if (delay_min < 0 || delay_min > next_evt_delay)
-			delay_min = next_evt_delay;
-	}
-
-	/* Determine time to next driver event. */
-	double driver_ts = driver->nextEventTime();
-	if (driver_ts >= 0.0) {
-		if (driver_ts <= ts) {
-			delay_min = 0;
-		} else {
-			long drv_delay = (driver_ts - ts) * 1000.0;
-			if (delay_min < 0 || drv_delay < delay_min)
-				delay_min = drv_delay;
-		}
-	}
+	quit = 1;
+	pomp_loop_wakeup(loop);
+}
 
-	if (delay_min == 0)
-		delay_min = 1; // Minimum to get the timer running
-	if (delay_min < 0) {
-		/* No more events, end of song */
-		seq_iter->end();
-		quit = 1;
-		pomp_loop_wakeup(loop);
+static void sched_timer_handler(int fd, uint32_t revents, void *userdata)
+{
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == -1) {
+		if (errno != EAGAIN)
+			printf("read() failed: %s\n", strerror(errno));
 		return;
 	}
-	pomp_timer_set(timer, delay_min);
+	nsec_t ts = get_time() + schedule_lead;
+	MIDIDRONE_PROBE2(timer_fire, ts, ts - sched_deadline);
+	if (telemetry)
+		telemetry->addLateness(ts - sched_deadline);
+	process_and_schedule(ts);
 }
 
-static void process_and_schedule(double ts)
+/* Conductor listener callbacks */
+static void go(const struct timespec *start, void *userdata)
 {
-	process_seq_event(ts);
-	driver->update(ts);
-	schedule_timer(ts);
+	time_offset = timespec_to_ns(start);
+	if (realtime)
+		alloc_guard_arm();
+	if (telemetry)
+		scheduler->addControl(telemetry->period(), status_control, NULL);
+	process_and_schedule(schedule_lead);
 }
 
-static void sig_handler(int sig)
+static void clock_corrected(nsec_t error, void *userdata)
+{
+	time_error = error;
+	if (!quit)
+		process_and_schedule(get_time() + schedule_lead);
+}
+
+static void conductor_heard(const struct sockaddr_in *addr, void *userdata)
+{
+	if (telemetry)
+		telemetry->setConductor(addr);
+}
+
+static void conductor_failed(void *userdata)
 {
 	quit = 1;
 	pomp_loop_wakeup(loop);
 }
 
-static void timer_handler(struct pomp_timer *t, void *userdata)
+static const ConductorListener::Callbacks listener_cbs = {
+	.go = go,
+	.corrected = clock_corrected,
+	.heard = conductor_heard,
+	.failed = conductor_failed,
+};
+
+static int sched_timer_setup(void)
 {
-	double ts = get_time();
-	process_and_schedule(ts);
+	int res;
+
+	sched_timer = timerfd_create(CLOCK_MONOTONIC,
+			TFD_CLOEXEC | TFD_NONBLOCK);
+	if (sched_timer == -1) {
+		printf("timerfd_create() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	res = pomp_loop_add(loop, sched_timer, POMP_FD_EVENT_IN,
+			sched_timer_handler, NULL);
+	if (res) {
+		printf("pomp_loop_add() failed: %s\n", strerror(-res));
+		close(sched_timer);
+		sched_timer = -1;
+		return -1;
+	}
+	return 0;
 }
 
-static void conductor_handler(int fd, uint32_t revents, void *userdata)
+static void prefault_stack(void)
 {
-	if (revents & POMP_FD_EVENT_IN) {
-		int res;
-		uint32_t buf;
-		uint32_t new_ts;
-		struct sockaddr_in saddr;
-		socklen_t saddr_sz = sizeof(saddr);
-
-		res = recvfrom(fd, &buf, sizeof(buf), 0, (struct sockaddr*)&saddr, &saddr_sz);
-		if (res == -1) {
-			printf("recvfrom() failed: %s\n", strerror(errno));
-			quit = 1;
-			pomp_loop_wakeup(loop);
-		}
-		new_ts = ntohl(buf);
-		if (!go_received && new_ts == 0) {
-			printf("Go received from %s:%d\n", inet_ntoa(saddr.sin_addr), ntohs(saddr.sin_port));
-			go_received = true;
-			init_time();
-			process_and_schedule(0.0);
-		} else if (go_received) {
-			double local_ts;
-			/* Recalculate time error */
-			time_error = 0.0;
-			local_ts = get_time();
-			time_error = new_ts - local_ts;
-
-			printf("Conductor timestamp: %u Local: %.4f "
-					"Error: %4f\n", new_ts, local_ts,
-					time_error);
-			pomp_timer_clear(timer);
-			process_and_schedule(new_ts);
-		}
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	long page = sysconf(_SC_PAGESIZE);
+	if (page <= 0)
+		page = 4096;
+	for (size_t i = 0; i < sizeof(stack); i += (size_t)page)
+		stack[i] = 0;
+}
+
+/* Keep the playback path off the page fault and allocator slow paths:
+ * lock all current and future pages in RAM, never give heap memory back to
+ * the system nor serve allocations with mmap(), and make the stack
+ * resident. */
+static int realtime_setup(void)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		printf("mlockall() failed: %s\n", strerror(errno));
+		return -1;
 	}
-	if (revents & (POMP_FD_EVENT_ERR | POMP_FD_EVENT_HUP)) {
-			printf("ERR or HUP event.\n");
-			quit = 1;
-			pomp_loop_wakeup(loop);
+	if (!mallopt(M_MMAP_MAX, 0) || !mallopt(M_TRIM_THRESHOLD, -1)) {
+		printf("mallopt() failed\n");
+		return -1;
 	}
+	prefault_stack();
+	return 0;
 }
 
-static int conductor_listener_setup(void)
+/* Make the driver calls of a trace recorded with -T, at their recorded
+ * dates relative to the first call: the wait for the conductor before it
+ * is not replayed. The whole trace is read before starting. */
+static int replay_trace(const char *path)
 {
+	struct trace_reader *reader;
+	struct trace_record record;
+	std::vector<struct trace_record> records;
+	struct timespec start;
+	nsec_t origin = 0;
+	unsigned long count = 0;
 	int res;
-	struct sockaddr_in addr;
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(5555);
-	addr.sin_addr.s_addr = INADDR_ANY;
-
-	conductor_sock = socket(AF_INET, SOCK_DGRAM, 0);
-	if (conductor_sock == -1) {
-		printf("socket() failed: %s\n", strerror(errno));
+
+	reader = trace_reader_new(path);
+	if (!reader)
+		return -1;
+	if (trace_reader_header(reader)->source != TRACE_SOURCE_MUSICIAN) {
+		printf("%s was not recorded by a musician\n", path);
+		trace_reader_destroy(reader);
 		return -1;
 	}
-	res = bind(conductor_sock, (const struct sockaddr*)&addr, sizeof(addr));
-	if (res == -1) {
-		printf("bind() failed: %s\n", strerror(errno));
-		close(conductor_sock);
-		conductor_sock = -1;
+	while ((res = trace_reader_next(reader, &record)) == 1)
+		records.push_back(record);
+	trace_reader_destroy(reader);
+	if (res < 0) {
+		printf("Failed to read %s\n", path);
 		return -1;
 	}
 
-	res = pomp_loop_add(loop, conductor_sock, POMP_FD_EVENT_IN,
-			conductor_handler, NULL);
-	if (res) {
-		printf("pomp_loop_add() failed: %s\n", strerror(-res));
-		close(conductor_sock);
-		conductor_sock = -1;
-		return -1;
+	if (!records.empty())
+		origin = records.front().date;
+	time_get_monotonic(&start);
+	for (auto it = records.begin(); it != records.end() && !quit; ++it) {
+		struct timespec deadline;
+		ns_to_timespec(timespec_to_ns(&start) + it->date - origin,
+				&deadline);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&deadline, NULL) == EINTR && !quit)
+			;
+		RecordingDriver::replay(driver, *it);
+		count++;
 	}
+	printf("Replayed %lu driver calls\n", count);
+	return 0;
+}
 
+/* Keep console writes off the playback path: from now on, the driver and
+ * the conductor handler only queue their messages. */
+static int playback_log_start(void)
+{
+	playback_log = new AsyncLog(stdout, LOG_FLUSH_PERIOD);
+	if (!playback_log->start()) {
+		delete playback_log;
+		playback_log = NULL;
+		return -1;
+	}
+	log_set_async(playback_log);
 	return 0;
 }
 
-int main(int argc, char* argv[])
+static void playback_log_stop(void)
 {
-	loop = pomp_loop_new();
-	timer = pomp_timer_new(loop, timer_handler, NULL);
+	if (!playback_log)
+		return;
+	log_set_async(NULL);
+	unsigned long dropped = playback_log->dropped();
+	delete playback_log;
+	playback_log = NULL;
+	if (dropped)
+		printf("Log: %lu messages dropped (ring full)\n", dropped);
+}
+
+static void usage(char* arg0)
+{
+	printf("Usage: %s [-F] [-R] [-A] [-t] [-P PRIO] [-c CPU] [-l MS] "
+			"[-p PORT] [-g GROUP [-i IFADDR]] [-O FILE] [-s METHOD] "
+			"[-w N] [-L MS [-B N]] [-k US] [-S MS] [-T TRACE] "
+			"[-W WAV] [-m NAME] [-y CHIP] MIDIFILE\n"
+			"       %s [-O FILE] [-T TRACE] [-W WAV] [-m NAME] "
+			"-r TRACE\n",
+			basename(arg0), basename(arg0));
+	printf("  -h    Show this usage screen and exit\n");
+	printf("  -F    Fast-forward: play the song on a virtual clock as\n");
+	printf("        fast as possible through the stdout driver, without\n");
+	printf("        conductor, and report the scheduling throughput\n");
+	printf("  -R    Real-time mode: lock the memory in RAM and preload\n");
+	printf("        everything, so that playback never page faults nor\n");
+	printf("        allocates (needs CAP_IPC_LOCK or a large enough\n");
+	printf("        RLIMIT_MEMLOCK)\n");
+	printf("  -A    Arm: set up the channels of the next notes while\n");
+	printf("        idle, so that starting a note takes a single\n");
+	printf("        hardware call (PWM driver)\n");
+	printf("  -t    Write to the hardware from a dedicated output thread\n");
+	printf("  -P PRIO Run the output thread with SCHED_FIFO priority\n");
+	printf("          PRIO (implies -t)\n");
+	printf("  -c CPU  Pin the output thread on CPU (implies -t)\n");
+	printf("  -l MS   Hand events to the output thread MS milliseconds\n");
+	printf("          ahead of their deadline (default: 5)\n");
+	printf("  -p PORT Listen to the conductor on UDP port PORT\n");
+	printf("          (default: %d)\n", CONDUCTOR_PORT);
+	printf("  -g GROUP  Also listen to the conductor on multicast group\n");
+	printf("            GROUP\n");
+	printf("  -i IFADDR IPv4 address of the interface joining the group\n");
+	printf("            (default: chosen by the kernel)\n");
+	printf("  -O FILE Log the monotonic date of each note onset to FILE\n");
+	printf("  -T TRACE Record every hardware driver call into the binary\n");
+	printf("           trace TRACE (see mididrone_trace)\n");
+	printf("  -m NAME Publish the driver channel states and the song\n");
+	printf("          time in the shared memory segment NAME, e.g.\n");
+	printf("          %s (see mididrone_feed)\n", FEED_DEFAULT_NAME);
+	printf("  -W WAV  Synthesize the channels into the WAV file WAV\n");
+	printf("          instead of playing them. With -F, renders the\n");
+	printf("          whole song faster than real time\n");
+	printf("  -y CHIP Drive the channels through the Linux PWM sysfs\n");
+	printf("          interface of CHIP, e.g. /sys/class/pwm/pwmchip0\n");
+	printf("  -r    Replay: the file argument is a trace recorded with\n");
+	printf("        -T, make its driver calls again at the same dates,\n");
+	printf("        without conductor\n");
+	printf("  -s METHOD Clock offset filter: 'mindelay' keeps the least\n");
+	printf("            delayed sample of the window, 'median' its median\n");
+	printf("            (default: mindelay)\n");
+	printf("  -w N    Clock offset filter window, in conductor ticks\n");
+	printf("          (default: 8, max: %u)\n", SyncFilter::maxWindow);
+	printf("  -L MS   Late event policy for events overdue by more than\n");
+	printf("          MS milliseconds, e.g. after a clock correction:\n");
+	printf("          drop notes already over, start the others with\n");
+	printf("          their remaining duration (default: play all\n");
+	printf("          overdue events as they are)\n");
+	printf("  -B N    Start at most N overdue notes per wakeup, drop the\n");
+	printf("          others (default: number of driver channels)\n");
+	printf("  -k US   Wakeup slack: process the events due less than US\n");
+	printf("          microseconds after a wakeup along with it, instead\n");
+	printf("          of waking up again (default: 0)\n");
+	printf("  -S MS   Report the playback status to the conductor every\n");
+	printf("          MS milliseconds (default: %d, 0: never)\n",
+			STATUS_PERIOD_MS);
+}
+
+static bool parse_uint(const char* str, unsigned int max, unsigned int* val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return false;
+	*val = (unsigned int)res;
+	return true;
+}
 
-	if (argc != 2) {
-		printf("Usage: %s MIDIFILE\n", basename(argv[0]));
+static struct opts parse_opts(int argc, char* argv[])
+{
+	struct opts opts = {
+		.ok = false,
+		.fast_forward = false,
+		.output_thread = false,
+		.realtime = false,
+		.replay = false,
+		.arm = false,
+		.output_prio = 0,
+		.output_cpu = -1,
+		.lead_ms = 5,
+		.port = CONDUCTOR_PORT,
+		.group = { .s_addr = htonl(INADDR_ANY) },
+		.ifaddr = { .s_addr = htonl(INADDR_ANY) },
+		.onset_file = nullptr,
+		.trace_file = nullptr,
+		.render_file = nullptr,
+		.feed_name = nullptr,
+		.pwm_chip = nullptr,
+		.sync_method = SyncFilter::MIN_DELAY,
+		.sync_window = 8,
+		.late_ms = -1,
+		.late_burst = 0,
+		.slack_us = 0,
+		.status_ms = STATUS_PERIOD_MS,
+		.filename = nullptr,
+	};
+	int opt = -1;
+	unsigned int val;
+
+	while((opt = getopt(argc, argv, ":AB:c:Fg:hi:k:L:l:m:O:p:P:rRs:S:tT:w:W:y:")) != -1) {
+		switch(opt) {
+		case 'A':
+			opts.arm = true;
+			break;
+		case 'B':
+			if (!parse_uint(optarg, UINT_MAX, &val) || val == 0) {
+				printf("Invalid value for -B: %s\n", optarg);
+				return opts;
+			}
+			opts.late_burst = val;
+			break;
+		case 'c':
+			if (!parse_uint(optarg, CPU_SETSIZE - 1, &val)) {
+				printf("Invalid value for -c: %s\n", optarg);
+				return opts;
+			}
+			opts.output_cpu = (int)val;
+			opts.output_thread = true;
+			break;
+		case 'F':
+			opts.fast_forward = true;
+			break;
+		case 'g':
+			if (inet_aton(optarg, &opts.group) == 0 ||
+			    !IN_MULTICAST(ntohl(opts.group.s_addr))) {
+				printf("Invalid multicast group: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'i':
+			if (inet_aton(optarg, &opts.ifaddr) == 0) {
+				printf("Invalid interface address: %s\n",
+						optarg);
+				return opts;
+			}
+			break;
+		case 'k':
+			if (!parse_uint(optarg, 1000000, &val)) {
+				printf("Invalid value for -k: %s\n", optarg);
+				return opts;
+			}
+			opts.slack_us = val;
+			break;
+		case 'L':
+			if (!parse_uint(optarg, 60000, &val)) {
+				printf("Invalid value for -L: %s\n", optarg);
+				return opts;
+			}
+			opts.late_ms = (int)val;
+			break;
+		case 'l':
+			if (!parse_uint(optarg, 1000, &val)) {
+				printf("Invalid value for -l: %s\n", optarg);
+				return opts;
+			}
+			opts.lead_ms = val;
+			break;
+		case 'm':
+			if (optarg[0] != '/' || strchr(optarg + 1, '/')) {
+				printf("Invalid value for -m: %s\n", optarg);
+				return opts;
+			}
+			opts.feed_name = optarg;
+			break;
+		case 'O':
+			opts.onset_file = optarg;
+			break;
+		case 'p':
+			if (!parse_uint(optarg, 65535, &val) || val == 0) {
+				printf("Invalid value for -p: %s\n", optarg);
+				return opts;
+			}
+			opts.port = val;
+			break;
+		case 'P':
+			if (!parse_uint(optarg, 99, &val) || val == 0) {
+				printf("Invalid value for -P: %s\n", optarg);
+				return opts;
+			}
+			opts.output_prio = (int)val;
+			opts.output_thread = true;
+			break;
+		case 'r':
+			opts.replay = true;
+			break;
+		case 'R':
+			opts.realtime = true;
+			break;
+		case 's':
+			if (strcmp(optarg, "median") == 0) {
+				opts.sync_method = SyncFilter::MEDIAN;
+			} else if (strcmp(optarg, "mindelay") == 0) {
+				opts.sync_method = SyncFilter::MIN_DELAY;
+			} else {
+				printf("Invalid value for -s: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'S':
+			if (!parse_uint(optarg, 60000, &val)) {
+				printf("Invalid value for -S: %s\n", optarg);
+				return opts;
+			}
+			opts.status_ms = val;
+			break;
+		case 't':
+			opts.output_thread = true;
+			break;
+		case 'T':
+			opts.trace_file = optarg;
+			break;
+		case 'w':
+			if (!parse_uint(optarg, SyncFilter::maxWindow, &val) ||
+			    val == 0) {
+				printf("Invalid value for -w: %s\n", optarg);
+				return opts;
+			}
+			opts.sync_window = val;
+			break;
+		case 'W':
+			opts.render_file = optarg;
+			break;
+		case 'y':
+			opts.pwm_chip = optarg;
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if ((argc - optind) != 1) {
+		usage(argv[0]);
+		return opts;
+	}
+
+	if (opts.fast_forward && opts.output_thread) {
+		printf("The output thread cannot be used in fast-forward mode.\n");
+		return opts;
+	}
+	if (opts.replay && (opts.fast_forward || opts.output_thread)) {
+		printf("Replay cannot be combined with -F or the output "
+				"thread.\n");
+		return opts;
+	}
+	if (opts.pwm_chip && (opts.fast_forward || opts.render_file)) {
+		printf("The sysfs PWM driver cannot be used with -F or -W.\n");
+		return opts;
+	}
+
+	opts.filename = argv[optind];
+	opts.ok = true;
+	return opts;
+}
+
+int main(int argc, char* argv[])
+{
+	int res;
+	/* The backend, by its class */
+	StdoutDriver *stdout_driver = NULL;
+	SysfsPwmDriver *sysfs_driver = NULL;
+#ifdef USE_MINIDRONES_PWM_DRIVER
+	PwmDriver *pwm_driver = NULL;
+#endif
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
 		return 1;
+
+	realtime = opts.realtime;
+	if (realtime && realtime_setup()) {
+		printf("realtime_setup() failed!\n");
+		return EXIT_FAILURE;
 	}
 
+	loop = pomp_loop_new();
+
 	signal(SIGINT, sig_handler);
 	signal(SIGQUIT, sig_handler);
 	signal(SIGHUP, sig_handler);
 
-	seq = new Alg_seq(argv[1], true);
-	seq->convert_to_seconds();
-	seq_iter = new Alg_iterator(seq, false);
-
+	if (!opts.replay)
+		score.load(opts.filename);
+
+	if (opts.render_file) {
+		struct render *render = render_new(opts.render_file,
+				RENDER_DEFAULT_RATE, RENDER_CHANNELS);
+		if (!render)
+			return EXIT_FAILURE;
+		printf("Rendering to %s\n", opts.render_file);
+		driver = new RenderDriver(render, RENDER_CHANNELS);
+	} else if (opts.fast_forward) {
+		/* Never drive the hardware faster than real time */
+		stdout_driver = new StdoutDriver();
+		driver = stdout_driver;
+	} else if (opts.pwm_chip) {
+		sysfs_driver = new SysfsPwmDriver(opts.pwm_chip,
+				SYSFS_PWM_CHANNELS);
+		driver = sysfs_driver;
+	} else {
 #ifdef USE_MINIDRONES_PWM_DRIVER
-	driver = new PwmDriver();
+		pwm_driver = new PwmDriver();
+		driver = pwm_driver;
 #else
-	driver = new StdoutDriver();
+		stdout_driver = new StdoutDriver();
+		driver = stdout_driver;
 #endif
+	}
+
+	if (opts.trace_file) {
+		struct trace_writer *writer = trace_writer_new(opts.trace_file,
+				TRACE_SOURCE_MUSICIAN, driver->channels(),
+				TRACE_BUFFER_RECORDS);
+		if (!writer)
+			return EXIT_FAILURE;
+		driver = new RecordingDriver(driver, writer);
+	}
 
-	if (conductor_listener_setup()) {
-		printf("conductor_listener_setup() failed!\n");
+	if (opts.onset_file) {
+		FILE *onsets = fopen(opts.onset_file, "w");
+		if (!onsets) {
+			printf("Cannot open %s: %s\n", opts.onset_file,
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+		driver = new OnsetDriver(driver, onsets);
+	}
+
+	/* Below the output thread: the feed follows the hardware writes */
+	if (opts.feed_name) {
+		struct feed_writer *feed = feed_writer_new(opts.feed_name,
+				(unsigned int)driver->channels());
+		if (!feed)
+			return EXIT_FAILURE;
+		driver = new FeedDriver(driver, feed);
+	}
+
+	/* Fast-forward output is the reference: keep it complete */
+	if (!opts.fast_forward && playback_log_start()) {
+		printf("playback_log_start() failed!\n");
 		return EXIT_FAILURE;
 	}
 
-	seq_iter->begin();
-	next_event = seq_iter->next();
+	if (opts.replay) {
+		printf("Replaying: %s\n", opts.filename);
+		res = replay_trace(opts.filename);
+		/* A complete trace ends with the recorded panic already */
+		if (res || quit)
+			driver->panic();
+		delete driver;
+		driver = NULL;
+		playback_log_stop();
+		pomp_loop_destroy(loop);
+		loop = NULL;
+		return res ? EXIT_FAILURE : 0;
+	}
 
-	printf("Playing: %s\n", argv[1]);
+	if (opts.output_thread) {
+		ThreadedDriver *threaded = new ThreadedDriver(driver,
+				song_time_to_deadline, opts.output_prio,
+				opts.output_cpu);
+		driver = threaded;
+		if (!threaded->start()) {
+			printf("Failed to start output thread!\n");
+			return EXIT_FAILURE;
+		}
+		schedule_lead = (nsec_t)opts.lead_ms * NSEC_PER_MSEC;
+	}
+
+	if (!opts.fast_forward) {
+		listener = new ConductorListener(loop, opts.sync_method,
+				opts.sync_window, listener_cbs, NULL);
+		if (!listener->start(opts.port, &opts.group, &opts.ifaddr)) {
+			printf("Failed to listen to the conductor!\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (!opts.fast_forward && opts.status_ms)
+		telemetry = new Telemetry(listener->fd(),
+				(nsec_t)opts.status_ms * NSEC_PER_MSEC);
+	if (!opts.fast_forward && sched_timer_setup()) {
+		printf("sched_timer_setup() failed!\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Without wrappers, the scheduler calls the backend directly */
+	if (driver == stdout_driver)
+		scheduler = new DriverScheduler<StdoutDriver>(score,
+				stdout_driver);
+	else if (driver == sysfs_driver)
+		scheduler = new DriverScheduler<SysfsPwmDriver>(score,
+				sysfs_driver);
+#ifdef USE_MINIDRONES_PWM_DRIVER
+	else if (driver == pwm_driver)
+		scheduler = new DriverScheduler<PwmDriver>(score, pwm_driver);
+#endif
+	else
+		scheduler = new DynamicScheduler(score, driver);
+	scheduler->setSlack((nsec_t)opts.slack_us * 1000);
+	if (opts.late_ms >= 0) {
+		scheduler->setLatePolicy((nsec_t)opts.late_ms * NSEC_PER_MSEC,
+				opts.late_burst ? opts.late_burst :
+				(unsigned int)driver->channels(),
+				schedule_lead);
+	}
+	scheduler->setArming(opts.arm);
+	scheduler->start();
+
+	printf("Playing: %s\n", opts.filename);
 	printf("Available channels: %i\n", driver->channels());
 
+	if (opts.fast_forward) {
+		fast_forward();
+		quit = 1;
+	}
+
 	while(!quit) {
 		pomp_loop_wait_and_process(loop, -1);
 	}
+	alloc_guard_disarm();
 
 	driver->panic();
 
-	pomp_loop_remove(loop, conductor_sock);
-	close(conductor_sock);
-	conductor_sock = -1;
+	if (telemetry && listener->started()) {
+		send_status(true);
+		printf("Status: %lu reports sent, %lu failed\n",
+				telemetry->sent(), telemetry->failed());
+	}
+
+	if (opts.late_ms >= 0) {
+		const Scheduler::Stats& stats(scheduler->stats());
+		printf("Late events: %lu started late, %lu dropped (over), "
+				"%lu dropped (burst limit)\n",
+				stats.lateTrimmed, stats.lateExpired,
+				stats.lateLimited);
+	}
+	if (opts.arm)
+		printf("Armed notes: %lu\n", scheduler->stats().armed);
+
+	delete listener;
+	listener = NULL;
+	if (sched_timer != -1) {
+		pomp_loop_remove(loop, sched_timer);
+		close(sched_timer);
+		sched_timer = -1;
+	}
 
-	pomp_timer_destroy(timer);
-	timer = NULL;
 	pomp_loop_destroy(loop);
 	loop = NULL;
 
+	delete scheduler;
+	scheduler = NULL;
 	delete driver;
 	driver = NULL;
-	delete seq_iter;
-	seq_iter = NULL;
-	delete seq;
-	seq = NULL;
+	playback_log_stop();
+	delete telemetry;
+	telemetry = NULL;
 	return 0;
 }
 
@@ -0,0 +1,79 @@
+#include "onset_driver.h"
+#include <futils/futils.h>
+
+OnsetDriver::OnsetDriver(Driver *driver, FILE *out) :
+	mDriver(driver),
+	mOut(out),
+	mBuffer(new char[mBufferSize])
+{
+	/* stdio would allocate its buffer on the first onset otherwise */
+	setvbuf(mOut, mBuffer, _IOFBF, mBufferSize);
+}
+
+OnsetDriver::~OnsetDriver()
+{
+	fclose(mOut);
+	delete[] mBuffer;
+	delete mDriver;
+}
+
+int OnsetDriver::channels()
+{
+	return mDriver->channels();
+}
+
+ChannelState OnsetDriver::channelState(int idx)
+{
+	return mDriver->channelState(idx);
+}
+
+bool OnsetDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel, int freq,
+		int ratio, nsec_t duration)
+{
+	struct timespec now;
+	bool res = mDriver->addNote(ts, starttime, lchannel, freq, ratio,
+			duration);
+	if (!res)
+		return false;
+
+	time_get_monotonic(&now);
+	fprintf(mOut, "%ld.%09ld %.6f %d %d\n", (long)now.tv_sec, now.tv_nsec,
+			ns_to_sec(starttime), lchannel, freq);
+	return true;
+}
+
+void OnsetDriver::update(nsec_t ts)
+{
+	mDriver->update(ts);
+}
+
+nsec_t OnsetDriver::nextEventTime()
+{
+	return mDriver->nextEventTime();
+}
+
+void OnsetDriver::releaseChannel(int idx)
+{
+	mDriver->releaseChannel(idx);
+}
+
+bool OnsetDriver::releaseLChannel(int lchan)
+{
+	return mDriver->releaseLChannel(lchan);
+}
+
+void OnsetDriver::panic()
+{
+	mDriver->panic();
+}
+
+bool OnsetDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq)
+{
+	return mDriver->armNote(ts, starttime, lchannel, freq);
+}
+
+unsigned long OnsetDriver::errors()
+{
+	return mDriver->errors();
+}
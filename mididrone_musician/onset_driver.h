@@ -0,0 +1,36 @@
+#ifndef ONSET_DRIVER_H_INCLUDED
+#define ONSET_DRIVER_H_INCLUDED
+
+#include <cstdio>
+#include "driver.h"
+
+/* Driver wrapper logging the CLOCK_MONOTONIC date at which each note
+ * actually reached the wrapped driver. One line per onset:
+ *   MONOTONIC_SEC.NSEC STARTTIME LCHANNEL FREQ
+ * Used to measure the synchronization between several musicians. */
+class OnsetDriver : public Driver
+{
+public:
+	/* Takes ownership of driver */
+	OnsetDriver(Driver *driver, FILE *out);
+	virtual ~OnsetDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
+private:
+	static const size_t mBufferSize = 64 * 1024;
+	Driver *mDriver;
+	FILE *mOut;
+	char *mBuffer;
+};
+
+#endif
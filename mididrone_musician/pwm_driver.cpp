@@ -3,14 +3,28 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/pwm_ioctl.h>
+#include <time.h>
+#include <probes.h>
 #include <cstring>
 #include <cerrno>
 #include <cstdio>
 
 #define PWM_DEV "/dev/pwm"
 
-PwmDriver::PwmDriver()
+static nsec_t monotonic_ns()
 {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_ns(&ts);
+}
+
+PwmDriver::PwmDriver() :
+	mArms(mNumChans),
+	mErrors(0)
+{
+	memset(mHwFreq, 0, sizeof(mHwFreq));
+	memset(&mColdOnsets, 0, sizeof(mColdOnsets));
+	memset(&mArmedOnsets, 0, sizeof(mArmedOnsets));
 	for (int i = 0; i < mNumChans; i ++) {
 		int fd;
 		int res;
@@ -39,6 +53,8 @@ PwmDriver::PwmDriver()
 
 PwmDriver::~PwmDriver()
 {
+	printOnsets("cold", mColdOnsets);
+	printOnsets("armed", mArmedOnsets);
 	for (int i = 0; i < mNumChans; i ++) {
 		int fd = mFds[i];
 		if (fd != -1) {
@@ -57,68 +73,117 @@ int PwmDriver::channels()
 	return mNumChans;
 }
 
+ChannelState PwmDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+/* Failures are counted, and the channel is left as is */
+int PwmDriver::control(int idx, unsigned long request, int *pwmdata,
+		const char *name)
+{
+	MIDIDRONE_PROBE3(pwm_ioctl_start, idx, request, pwmdata ? *pwmdata : 0);
+	int res = ioctl(mFds[idx], request, pwmdata);
+	MIDIDRONE_PROBE3(pwm_ioctl_done, idx, request, res);
+	if (res == -1) {
+		mErrors.fetch_add(1, std::memory_order_relaxed);
+		printf("ioctl %s failed: %s\n", name, strerror(errno));
+	}
+	return res;
+}
+
 void PwmDriver::applyChannelCfg(int idx)
 {
-	int res;
 	int pwmdata;
 	ChannelState& chan = mChans[idx];
 
 	pwmdata = 0;
-	res = ioctl(mFds[idx], PWM_SET_WIDTH, &pwmdata);
-	if (res == -1) {
-		printf("ioctl PWM_SET_WIDTH failed: %s\n", strerror(errno));
-	}
+	control(idx, PWM_SET_WIDTH, &pwmdata, "PWM_SET_WIDTH");
 
 	pwmdata = chan.freq;
-	res = ioctl(mFds[idx], PWM_SET_FREQ, &pwmdata);
-	if (res == -1) {
-		printf("ioctl PWM_SET_FREQ failed: %s\n", strerror(errno));
-	}
+	control(idx, PWM_SET_FREQ, &pwmdata, "PWM_SET_FREQ");
+	mHwFreq[idx] = chan.freq;
 
 	pwmdata = chan.ratio;
-	res = ioctl(mFds[idx], PWM_SET_WIDTH, &pwmdata);
-	if (res == -1) {
-		printf("ioctl PWM_SET_WIDTH failed: %s\n", strerror(errno));
-	}
+	control(idx, PWM_SET_WIDTH, &pwmdata, "PWM_SET_WIDTH");
 
-	res = ioctl(mFds[idx], PWM_START, 0);
-	if (res == -1) {
-		printf("ioctl PWM_START failed: %s\n", strerror(errno));
-	}
+	control(idx, PWM_START, 0, "PWM_START");
+}
+
+/* Armed channel: started silent at the right frequency already */
+void PwmDriver::applyChannelOnset(int idx)
+{
+	int pwmdata = mChans[idx].ratio;
+	control(idx, PWM_SET_WIDTH, &pwmdata, "PWM_SET_WIDTH");
 }
 
 void PwmDriver::applyChannelRelease(int idx)
 {
-	int res;
 	int pwmdata;
 
 	pwmdata = 0;
-	res = ioctl(mFds[idx], PWM_SET_WIDTH, &pwmdata);
-	if (res == -1) {
-		printf("ioctl PWM_SET_WIDTH failed: %s\n", strerror(errno));
+	control(idx, PWM_SET_WIDTH, &pwmdata, "PWM_SET_WIDTH");
+}
+
+bool PwmDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel, int freq,
+		int ratio, nsec_t duration)
+{
+	nsec_t start = monotonic_ns();
+	bool armed;
+	int idx;
+
+	update(ts);
+	idx = mArms.pick(mChans, lchannel, freq, &armed);
+	if (idx < 0)
+		return false;
+
+	ChannelState& chan(mChans[idx]);
+	chan.busy = true;
+	chan.freq = freq;
+	chan.ratio = ratio;
+	chan.lchannel = lchannel;
+	chan.stoptime = starttime + duration;
+	mArms.noteStarted(idx, starttime);
+	if (armed) {
+		applyChannelOnset(idx);
+		addOnset(mArmedOnsets, start);
+	} else {
+		applyChannelCfg(idx);
+		addOnset(mColdOnsets, start);
 	}
+	return true;
 }
 
-bool PwmDriver::addNote(double ts, double starttime, int lchannel, int freq,
-		int ratio, double duration)
+bool PwmDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel, int freq)
 {
+	bool done;
+	int idx;
+	int pwmdata;
+
 	update(ts);
-	for (int i = 0; i < mNumChans; ++i) {
-		ChannelState& chan(mChans[i]);
-		if (chan.busy)
-			continue;
-		chan.busy = true;
-		chan.freq = freq;
-		chan.ratio = ratio;
-		chan.lchannel = lchannel;
-		chan.stoptime = starttime + duration;
-		applyChannelCfg(i);
-		return true;
+	/* Best is a channel at that frequency already */
+	idx = mArms.pickFree(mChans, starttime, lchannel, freq, &done,
+			[this, freq](int i) { return mHwFreq[i] == freq; });
+	if (idx < 0)
+		return done;
+
+	/* A free channel has a zero width: it stays silent */
+	if (mHwFreq[idx] != freq) {
+		pwmdata = freq;
+		if (control(idx, PWM_SET_FREQ, &pwmdata, "PWM_SET_FREQ")) {
+			mHwFreq[idx] = 0;
+			return false;
+		}
+		mHwFreq[idx] = freq;
 	}
-	return false;
+	if (control(idx, PWM_START, 0, "PWM_START"))
+		return false;
+
+	mArms.arm(idx, starttime, lchannel, freq);
+	return true;
 }
 
-void PwmDriver::update(double ts)
+void PwmDriver::update(nsec_t ts)
 {
 	for (int i = 0; i < mNumChans; ++i) {
 		ChannelState& chan(mChans[i]);
@@ -128,13 +193,13 @@ void PwmDriver::update(double ts)
 	}
 }
 
-double PwmDriver::nextEventTime()
+nsec_t PwmDriver::nextEventTime()
 {
-	double closest = -1.0;
+	nsec_t closest = -1;
 	for (int i = 0; i < mNumChans; ++i) {
 		ChannelState& chan(mChans[i]);
 		if (chan.busy) {
-			if (closest < 0.0 || chan.stoptime < closest) {
+			if (closest < 0 || chan.stoptime < closest) {
 				closest = chan.stoptime;
 			}
 		}
@@ -164,6 +229,7 @@ bool PwmDriver::releaseLChannel(int lchan)
 
 void PwmDriver::panic()
 {
+	mArms.clear();
 	for (int i = 0; i < mNumChans; i ++) {
 		releaseChannel(i);
 		mChans[i].freq = 0;
@@ -171,3 +237,28 @@ void PwmDriver::panic()
 	}
 }
 
+
+unsigned long PwmDriver::errors()
+{
+	return mErrors.load(std::memory_order_relaxed);
+}
+
+void PwmDriver::addOnset(Onsets& onsets, nsec_t start)
+{
+	nsec_t latency = monotonic_ns() - start;
+
+	onsets.count++;
+	onsets.sum += latency;
+	if (latency > onsets.max)
+		onsets.max = latency;
+}
+
+void PwmDriver::printOnsets(const char *name, const Onsets& onsets)
+{
+	if (!onsets.count)
+		return;
+	printf("PWM onsets (%s): %lu, latency mean %.1f us, max %.1f us\n",
+			name, onsets.count,
+			(double)onsets.sum / onsets.count / 1000.0,
+			(double)onsets.max / 1000.0);
+}
@@ -1,27 +1,53 @@
 #ifndef PWM_DRIVER_H_INCLUDED
 #define PWM_DRIVER_H_INCLUDED
 
+#include <atomic>
 #include "driver.h"
+#include "channel_arms.h"
 
-class PwmDriver : public Driver
+class PwmDriver final : public Driver
 {
 public:
 	PwmDriver();
 	virtual ~PwmDriver();
 	virtual int channels();
-	virtual bool addNote(double ts, double starttime, int lchannel,
-			int freq, int ratio, double duration);
-	virtual void update(double ts);
-	virtual double nextEventTime();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
 	virtual void releaseChannel(int idx);
 	virtual bool releaseLChannel(int lchan);
 	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
 private:
+	/* Time from addNote() to the hardware call making the sound */
+	struct Onsets {
+		unsigned long count;
+		nsec_t sum;
+		nsec_t max;
+	};
+
 	void applyChannelCfg(int idx);
+	void applyChannelOnset(int idx);
+	void addOnset(Onsets& onsets, nsec_t start);
+	void printOnsets(const char *name, const Onsets& onsets);
 	void applyChannelRelease(int idx);
+	int control(int idx, unsigned long request, int *pwmdata,
+			const char *name);
 	static const int mNumChans = 4;
 	ChannelState mChans[mNumChans];
 	int mFds[mNumChans];
+	/* Armed channels are free with their frequency set */
+	ChannelArms mArms;
+	/* Last frequency set on the hardware, 0 when unknown */
+	int mHwFreq[mNumChans];
+	Onsets mColdOnsets;
+	Onsets mArmedOnsets;
+	/* Read from the scheduler thread with the output thread */
+	std::atomic<unsigned long> mErrors;
 };
 
 #endif
@@ -0,0 +1,130 @@
+#include "recording_driver.h"
+#include <cstring>
+#include <cstdio>
+
+RecordingDriver::RecordingDriver(Driver *driver, struct trace_writer *writer) :
+	mDriver(driver),
+	mWriter(writer)
+{
+}
+
+RecordingDriver::~RecordingDriver()
+{
+	unsigned long lost = trace_writer_destroy(mWriter);
+	if (lost)
+		printf("Trace: %lu records lost\n", lost);
+	delete mDriver;
+}
+
+void RecordingDriver::record(uint16_t type, nsec_t ts, int channel,
+		int lchannel, bool result)
+{
+	struct trace_record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.date = trace_writer_date(mWriter);
+	rec.ts = ts;
+	rec.type = type;
+	rec.channel = (int16_t)channel;
+	rec.lchannel = (int16_t)lchannel;
+	rec.result = result;
+	trace_writer_add(mWriter, &rec);
+}
+
+int RecordingDriver::channels()
+{
+	return mDriver->channels();
+}
+
+ChannelState RecordingDriver::channelState(int idx)
+{
+	return mDriver->channelState(idx);
+}
+
+bool RecordingDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	struct trace_record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.ts = ts;
+	rec.starttime = starttime;
+	rec.duration = duration;
+	rec.freq = (uint32_t)freq;
+	rec.type = TRACE_ADD_NOTE;
+	rec.channel = -1;
+	rec.lchannel = (int16_t)lchannel;
+	rec.ratio = (uint16_t)ratio;
+	rec.date = trace_writer_date(mWriter);
+	rec.result = mDriver->addNote(ts, starttime, lchannel, freq, ratio,
+			duration);
+	trace_writer_add(mWriter, &rec);
+	return rec.result;
+}
+
+void RecordingDriver::update(nsec_t ts)
+{
+	record(TRACE_UPDATE, ts, -1, -1, true);
+	mDriver->update(ts);
+}
+
+nsec_t RecordingDriver::nextEventTime()
+{
+	return mDriver->nextEventTime();
+}
+
+void RecordingDriver::releaseChannel(int idx)
+{
+	record(TRACE_RELEASE, -1, idx, -1, true);
+	mDriver->releaseChannel(idx);
+}
+
+bool RecordingDriver::releaseLChannel(int lchan)
+{
+	bool res = mDriver->releaseLChannel(lchan);
+	record(TRACE_RELEASE_LCHANNEL, -1, -1, lchan, res);
+	return res;
+}
+
+void RecordingDriver::panic()
+{
+	record(TRACE_PANIC, -1, -1, -1, true);
+	mDriver->panic();
+}
+
+/* Not recorded: it changes no channel state */
+bool RecordingDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq)
+{
+	return mDriver->armNote(ts, starttime, lchannel, freq);
+}
+
+unsigned long RecordingDriver::errors()
+{
+	return mDriver->errors();
+}
+
+void RecordingDriver::replay(Driver *driver, const struct trace_record& record)
+{
+	switch (record.type) {
+	case TRACE_ADD_NOTE:
+		driver->addNote(record.ts, record.starttime, record.lchannel,
+				(int)record.freq, record.ratio,
+				record.duration);
+		break;
+	case TRACE_UPDATE:
+		driver->update(record.ts);
+		break;
+	case TRACE_RELEASE:
+		driver->releaseChannel(record.channel);
+		break;
+	case TRACE_RELEASE_LCHANNEL:
+		driver->releaseLChannel(record.lchannel);
+		break;
+	case TRACE_PANIC:
+		driver->panic();
+		break;
+	default:
+		printf("Trace: unexpected %s record\n",
+				trace_type_str(record.type));
+		break;
+	}
+}
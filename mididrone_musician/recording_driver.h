@@ -0,0 +1,38 @@
+#ifndef RECORDING_DRIVER_H_INCLUDED
+#define RECORDING_DRIVER_H_INCLUDED
+
+#include <trace.h>
+#include "driver.h"
+
+/* Driver wrapper recording every call made on the wrapped driver, with
+ * its date, into a binary trace (see libmididrone_trace). */
+class RecordingDriver : public Driver
+{
+public:
+	/* Takes ownership of driver and writer */
+	RecordingDriver(Driver *driver, struct trace_writer *writer);
+	virtual ~RecordingDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
+
+	/* Make the call described by a record of a musician trace */
+	static void replay(Driver *driver, const struct trace_record& record);
+private:
+	void record(uint16_t type, nsec_t ts, int channel, int lchannel,
+			bool result);
+
+	Driver *mDriver;
+	struct trace_writer *mWriter;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "render_driver.h"
+
+/* The render library has its own full scale */
+static int render_ratio(int ratio)
+{
+	return ratio * RENDER_RATIO_MAX / DRIVER_RATIO_MAX;
+}
+
+RenderDriver::RenderDriver(struct render *render, int channels) :
+	mRender(render),
+	mNumChans(channels),
+	mChans(new ChannelState[channels])
+{
+	panic();
+}
+
+RenderDriver::~RenderDriver()
+{
+	render_destroy(mRender);
+	delete[] mChans;
+}
+
+int RenderDriver::channels()
+{
+	return mNumChans;
+}
+
+ChannelState RenderDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool RenderDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	update(ts);
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy)
+			continue;
+		chan.busy = true;
+		chan.freq = freq;
+		chan.ratio = ratio;
+		chan.lchannel = lchannel;
+		chan.stoptime = starttime + duration;
+		render_set(mRender, i, freq, render_ratio(ratio));
+		return true;
+	}
+	return false;
+}
+
+/* Releases are rendered at their stop dates, not at the date of the
+ * call, in date order */
+void RenderDriver::update(nsec_t ts)
+{
+	while (1) {
+		int next = -1;
+		for (int i = 0; i < mNumChans; ++i) {
+			ChannelState& chan(mChans[i]);
+			if (chan.busy && chan.stoptime <= ts && (next < 0 ||
+					chan.stoptime < mChans[next].stoptime))
+				next = i;
+		}
+		if (next < 0)
+			break;
+		render_advance(mRender, mChans[next].stoptime);
+		releaseChannel(next);
+	}
+	render_advance(mRender, ts);
+}
+
+nsec_t RenderDriver::nextEventTime()
+{
+	nsec_t closest = -1;
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && (closest < 0 || chan.stoptime < closest))
+			closest = chan.stoptime;
+	}
+	return closest;
+}
+
+void RenderDriver::releaseChannel(int idx)
+{
+	mChans[idx].busy = false;
+	mChans[idx].lchannel = -1;
+	render_set(mRender, idx, 0, 0);
+}
+
+bool RenderDriver::releaseLChannel(int lchan)
+{
+	bool success = false;
+	for (int i = 0; i < mNumChans; i ++) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.lchannel == lchan) {
+			releaseChannel(i);
+			success = true;
+		}
+	}
+	return success;
+}
+
+void RenderDriver::panic()
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		releaseChannel(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+}
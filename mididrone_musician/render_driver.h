@@ -0,0 +1,32 @@
+#ifndef RENDER_DRIVER_H_INCLUDED
+#define RENDER_DRIVER_H_INCLUDED
+
+#include <render.h>
+#include "driver.h"
+
+/* Driver synthesizing the channels into a WAV file instead of playing
+ * them, on the song timeline of the calls: in fast-forward mode, a whole
+ * song renders much faster than real time. Channels are allocated like
+ * the stdout driver does. */
+class RenderDriver : public Driver
+{
+public:
+	/* Takes ownership of render */
+	RenderDriver(struct render *render, int channels);
+	virtual ~RenderDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+private:
+	struct render *mRender;
+	int mNumChans;
+	ChannelState *mChans;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "scheduler.h"
+#include <math.h>
+#include <cstring>
+
+static int key2freq(int key)
+{
+	double freq = pow(2.0, ((double)key - 69.0) / 12.0) * 440.0;
+	return (int)round(freq);
+}
+
+static int loud2ratio(int loud)
+{
+	return loud * 2;
+}
+
+Scheduler::Scheduler(const Score& score, int channels) :
+	mScore(score),
+	mChannels(channels),
+	mNextNote(0),
+	mSlack(0),
+	mLateThreshold(-1),
+	mLateBurst(0),
+	mLead(0),
+	mArming(false),
+	mArmedNote((size_t)-1),
+	/* At most one pending release per channel, the next note, and the
+	 * control actions */
+	mCapacity(channels + 1 + maxControls),
+	mSize(0),
+	mControlItems(0),
+	mOrder(0),
+	mItems(new Item[mCapacity])
+{
+	memset(mControls, 0, sizeof(mControls));
+	memset(&mStats, 0, sizeof(mStats));
+}
+
+Scheduler::~Scheduler()
+{
+	delete[] mItems;
+}
+
+void Scheduler::setSlack(nsec_t slack)
+{
+	mSlack = slack;
+}
+
+void Scheduler::setLatePolicy(nsec_t threshold, unsigned int burst,
+		nsec_t lead)
+{
+	mLateThreshold = threshold;
+	mLateBurst = burst;
+	mLead = lead;
+}
+
+void Scheduler::setArming(bool arming)
+{
+	mArming = arming;
+}
+
+void Scheduler::start()
+{
+	mNextNote = 0;
+	queueNote();
+}
+
+bool Scheduler::addControl(nsec_t date, ControlFn fn, void *userdata)
+{
+	for (unsigned int i = 0; i < maxControls; i++) {
+		if (mControls[i].fn)
+			continue;
+		if (!push(date, ITEM_CONTROL, i))
+			return false;
+		mControls[i].fn = fn;
+		mControls[i].userdata = userdata;
+		mControlItems++;
+		return true;
+	}
+	mStats.overflows++;
+	return false;
+}
+
+void Scheduler::noteCall(size_t idx, NoteCall *call) const
+{
+	const ScoreNote& note(mScore[idx]);
+	int key = std::min(std::max(note.key, 0), 127);
+	int loud = std::min(std::max(note.loud, 0), 127);
+
+	call->starttime = note.time;
+	call->duration = note.duration;
+	call->lchannel = note.chan & 15;
+	call->freq = key2freq(key);
+	call->ratio = loud2ratio(loud);
+}
+
+bool Scheduler::prepareNote(nsec_t ts, unsigned int *late_notes,
+		NoteCall *call)
+{
+	nsec_t now = ts - mLead;
+
+	mStats.events++;
+	noteCall(mNextNote, call);
+	if (mLateThreshold >= 0 && now - call->starttime > mLateThreshold) {
+		if (call->starttime + call->duration <= now) {
+			mStats.lateExpired++;
+			return false;
+		}
+		if (mLateBurst && *late_notes >= mLateBurst) {
+			mStats.lateLimited++;
+			return false;
+		}
+		(*late_notes)++;
+		mStats.lateTrimmed++;
+		call->duration = call->starttime + call->duration - now;
+		call->starttime = now;
+	}
+
+	mStats.driverCalls++;
+	MIDIDRONE_PROBE4(note, ts, call->starttime, call->lchannel,
+			mScore[mNextNote].key);
+	return true;
+}
+
+void Scheduler::runControl(nsec_t ts, unsigned int slot)
+{
+	Control control(mControls[slot]);
+	mControls[slot].fn = NULL;
+	mControlItems--;
+	control.fn(ts, control.userdata);
+}
+
+const Scheduler::Stats& Scheduler::stats() const
+{
+	return mStats;
+}
+
+template class DriverScheduler<Driver>;
@@ -0,0 +1,273 @@
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <probes.h>
+#include <algorithm>
+#include "timeline.h"
+#include "score.h"
+#include "driver.h"
+
+/* Every deadline of one musician in a single priority queue: the next
+ * score note, the pending driver releases and control actions. A wakeup
+ * processes exactly the items due, in date order, and tells when the next
+ * one is. Items due less than the slack after the wakeup date are
+ * processed with it instead of needing their own wakeup.
+ * The queue has a fixed capacity, allocated when the scheduler is
+ * created: nothing is allocated while playing.
+ * The driver calls are made by DriverScheduler, below. */
+class Scheduler
+{
+public:
+	typedef void (*ControlFn)(nsec_t ts, void *userdata);
+
+	struct Stats {
+		unsigned long events;
+		unsigned long driverCalls;
+		unsigned long wakeups;
+		unsigned long coalesced;
+		unsigned long overflows;
+		unsigned long refused; // No free driver channel
+		unsigned long lateTrimmed;
+		unsigned long lateExpired;
+		unsigned long lateLimited;
+		unsigned long armed; // Notes of chords armed in full ahead
+	};
+
+	static const unsigned int maxControls = 8;
+
+	Scheduler(const Score& score, int channels);
+	virtual ~Scheduler();
+	void setSlack(nsec_t slack);
+	/* Notes overdue by more than threshold are dropped when already
+	 * over, or started with their remaining duration, at most burst per
+	 * wakeup (0: no limit). A negative threshold disables the policy.
+	 * Lateness is measured against the wakeup date minus lead. */
+	void setLatePolicy(nsec_t threshold, unsigned int burst, nsec_t lead);
+	/* Before sleeping, let the driver set up the channels of the next
+	 * notes (see Driver::armNote) */
+	void setArming(bool arming);
+	/* Queue the first note of the score */
+	void start();
+	bool addControl(nsec_t date, ControlFn fn, void *userdata);
+	/* Process the items due at ts. Returns the date of the next item,
+	 * or -1 when there is nothing left to play: control items alone do
+	 * not keep the song going. */
+	virtual nsec_t process(nsec_t ts) = 0;
+	/* Same as process() returns */
+	nsec_t nextDeadline() const;
+	const Stats& stats() const;
+protected:
+	/* Processing order of items due at the same date */
+	enum ItemType {
+		ITEM_RELEASE,
+		ITEM_NOTE,
+		ITEM_CONTROL,
+	};
+
+	struct Item {
+		nsec_t date;
+		unsigned long order;
+		ItemType type;
+		unsigned int arg; // Control slot
+	};
+
+	struct Control {
+		ControlFn fn;
+		void *userdata;
+	};
+
+	/* Driver call for a score note */
+	struct NoteCall {
+		nsec_t starttime;
+		nsec_t duration;
+		int lchannel;
+		int freq;
+		int ratio;
+	};
+
+	static bool later(const Item& a, const Item& b);
+	bool push(nsec_t date, ItemType type, unsigned int arg);
+	void pop();
+	void queueNote();
+	/* Apply the late policy to the next note. Returns false when it is
+	 * dropped, else fills in its driver call. */
+	bool prepareNote(nsec_t ts, unsigned int *late_notes, NoteCall *call);
+	/* Driver call for score note idx, as written */
+	void noteCall(size_t idx, NoteCall *call) const;
+	void noteAdded(const NoteCall& call, bool added);
+	void runControl(nsec_t ts, unsigned int slot);
+
+	const Score& mScore;
+	int mChannels;
+	size_t mNextNote;
+	nsec_t mSlack;
+	nsec_t mLateThreshold;
+	unsigned int mLateBurst;
+	nsec_t mLead;
+	bool mArming;
+	/* First note of the last chord fully armed */
+	size_t mArmedNote;
+	unsigned int mCapacity;
+	unsigned int mSize;
+	/* Control items among them */
+	unsigned int mControlItems;
+	unsigned long mOrder;
+	Item *mItems;
+	Control mControls[maxControls];
+	Stats mStats;
+};
+
+/* Queue operations, made for every item: inline in process().
+ * std heap functions build a max-heap: the latest item sinks. */
+inline bool Scheduler::later(const Item& a, const Item& b)
+{
+	if (a.date != b.date)
+		return a.date > b.date;
+	if (a.type != b.type)
+		return a.type > b.type;
+	return a.order > b.order;
+}
+
+inline bool Scheduler::push(nsec_t date, ItemType type, unsigned int arg)
+{
+	if (mSize == mCapacity) {
+		mStats.overflows++;
+		return false;
+	}
+	Item& item(mItems[mSize++]);
+	item.date = date;
+	item.order = mOrder++;
+	item.type = type;
+	item.arg = arg;
+	std::push_heap(mItems, mItems + mSize, later);
+	return true;
+}
+
+inline void Scheduler::pop()
+{
+	std::pop_heap(mItems, mItems + mSize, later);
+	mSize--;
+}
+
+inline void Scheduler::queueNote()
+{
+	if (mNextNote < mScore.size())
+		push(mScore[mNextNote].time, ITEM_NOTE, 0);
+}
+
+inline void Scheduler::noteAdded(const NoteCall& call, bool added)
+{
+	if (added)
+		push(call.starttime + call.duration, ITEM_RELEASE, 0);
+	else
+		mStats.refused++;
+}
+
+inline nsec_t Scheduler::nextDeadline() const
+{
+	return mSize > mControlItems ? mItems[0].date : -1;
+}
+
+/* Scheduler calling a driver of type D. When D is a final class, the
+ * driver calls are direct, and inlined when D defines them in its header:
+ * builds where the backend is known at compile time use it that way. With
+ * D = Driver, any driver stack goes, through virtual calls. Either way the
+ * only virtual call left is process(), once per wakeup. */
+template <class D>
+class DriverScheduler : public Scheduler
+{
+public:
+	DriverScheduler(const Score& score, D *driver);
+	virtual nsec_t process(nsec_t ts);
+private:
+	void armNext(nsec_t ts);
+
+	D *mDriver;
+};
+
+typedef DriverScheduler<Driver> DynamicScheduler;
+extern template class DriverScheduler<Driver>;
+
+template <class D>
+DriverScheduler<D>::DriverScheduler(const Score& score, D *driver) :
+	Scheduler(score, driver->channels()),
+	mDriver(driver)
+{
+}
+
+template <class D>
+nsec_t DriverScheduler<D>::process(nsec_t ts)
+{
+	unsigned int late_notes = 0;
+	nsec_t released = -1;
+	NoteCall call;
+
+	MIDIDRONE_PROBE2(process_start, ts, mSize);
+	mStats.wakeups++;
+	while (mSize > 0 && mItems[0].date <= ts + mSlack) {
+		Item item(mItems[0]);
+		/* Items taken ahead of time are processed at their own date */
+		nsec_t at = std::max(ts, item.date);
+		if (item.date > ts)
+			mStats.coalesced++;
+		pop();
+		MIDIDRONE_PROBE3(event, at, item.date, (int)item.type);
+
+		switch (item.type) {
+		case ITEM_RELEASE:
+			/* One update releases all the notes ending together,
+			 * e.g. a chord: the others need no call */
+			if (at == released)
+				break;
+			released = at;
+			mStats.driverCalls++;
+			mDriver->update(at);
+			break;
+		case ITEM_NOTE:
+			if (prepareNote(at, &late_notes, &call))
+				noteAdded(call, mDriver->addNote(at,
+							call.starttime,
+							call.lchannel,
+							call.freq, call.ratio,
+							call.duration));
+			mNextNote++;
+			queueNote();
+			break;
+		case ITEM_CONTROL:
+			runControl(at, item.arg);
+			break;
+		}
+	}
+	if (mArming)
+		armNext(ts);
+	MIDIDRONE_PROBE2(process_done, ts, nextDeadline());
+	return nextDeadline();
+}
+
+/* The notes of a chord start together: arm them all, and try again on
+ * the next wakeups until the driver took them all, e.g. once a channel
+ * was released. */
+template <class D>
+void DriverScheduler<D>::armNext(nsec_t ts)
+{
+	size_t idx = mNextNote;
+	bool all = true;
+	NoteCall call;
+
+	if (mArmedNote == mNextNote || mNextNote >= mScore.size())
+		return;
+	while (idx < mScore.size() && idx - mNextNote < (size_t)mChannels &&
+			mScore[idx].time == mScore[mNextNote].time) {
+		noteCall(idx, &call);
+		if (!mDriver->armNote(ts, call.starttime, call.lchannel,
+					call.freq))
+			all = false;
+		idx++;
+	}
+	if (all) {
+		mArmedNote = mNextNote;
+		mStats.armed += idx - mNextNote;
+	}
+}
+
+#endif
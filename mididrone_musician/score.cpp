@@ -0,0 +1,29 @@
+#include "score.h"
+#include <allegro.h>
+
+Score::Score() :
+	mNotes()
+{
+}
+
+void Score::load(const char *filename)
+{
+	Alg_seq seq(filename, true);
+	seq.convert_to_seconds();
+
+	mNotes.clear();
+	Alg_iterator iterator(&seq, false);
+	iterator.begin();
+	for (Alg_event_ptr e = iterator.next(); e; e = iterator.next()) {
+		ScoreNote note;
+		if (!e->is_note())
+			continue;
+		note.time = sec_to_ns(e->time);
+		note.duration = sec_to_ns(e->get_duration());
+		note.chan = e->chan;
+		note.key = e->get_identifier();
+		note.loud = (int) e->get_loud();
+		mNotes.push_back(note);
+	}
+	iterator.end();
+}
@@ -0,0 +1,31 @@
+#ifndef SCORE_H_INCLUDED
+#define SCORE_H_INCLUDED
+
+#include <vector>
+#include <cstddef>
+#include "timeline.h"
+
+struct ScoreNote
+{
+	nsec_t time;
+	nsec_t duration;
+	int chan;
+	int key;
+	int loud;
+};
+
+/* Notes of a MIDI file, in time order. The whole file is decoded at load
+ * time, so that walking the score during playback never allocates, and
+ * dates are converted to the integer timeline once and for all. */
+class Score
+{
+public:
+	Score();
+	void load(const char *filename);
+	size_t size() const { return mNotes.size(); }
+	const ScoreNote& operator[](size_t idx) const { return mNotes[idx]; }
+private:
+	std::vector<ScoreNote> mNotes;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SPSC_RING_H_INCLUDED
+#define SPSC_RING_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+/* Bounded single-producer/single-consumer ring.
+ * push() is only called from the producer thread, front()/pop() only from
+ * the consumer thread. Both sides are wait-free: they never loop nor block,
+ * push() simply fails when the ring is full. */
+template <typename T, unsigned int N>
+class SpscRing
+{
+	static_assert(N != 0 && (N & (N - 1)) == 0,
+			"SpscRing size must be a power of two");
+public:
+	SpscRing() : mHead(0), mTail(0) {}
+
+	bool push(const T& item)
+	{
+		unsigned int tail = mTail.load(std::memory_order_relaxed);
+		if (tail - mHead.load(std::memory_order_acquire) == N)
+			return false;
+		mItems[tail & (N - 1)] = item;
+		mTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Oldest item, or NULL when the ring is empty. The item stays valid
+	 * until pop() is called. */
+	T* front()
+	{
+		unsigned int head = mHead.load(std::memory_order_relaxed);
+		if (head == mTail.load(std::memory_order_acquire))
+			return NULL;
+		return &mItems[head & (N - 1)];
+	}
+
+	void pop()
+	{
+		unsigned int head = mHead.load(std::memory_order_relaxed);
+		mHead.store(head + 1, std::memory_order_release);
+	}
+
+	bool empty()
+	{
+		return mHead.load(std::memory_order_acquire) ==
+			mTail.load(std::memory_order_acquire);
+	}
+
+private:
+	T mItems[N];
+	/* Keep producer and consumer indexes on separate cache lines. */
+	std::atomic<unsigned int> mHead;
+	char mPad[64 - sizeof(std::atomic<unsigned int>)];
+	std::atomic<unsigned int> mTail;
+};
+
+#endif
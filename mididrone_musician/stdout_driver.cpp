@@ -1,5 +1,5 @@
 #include "stdout_driver.h"
-#include <cstdio>
+#include "async_log.h"
 
 StdoutDriver::StdoutDriver()
 {
@@ -15,8 +15,13 @@ int StdoutDriver::channels()
 	return mNumChans;
 }
 
-bool StdoutDriver::addNote(double ts, double starttime, int lchannel, int freq,
-		int ratio, double duration)
+ChannelState StdoutDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool StdoutDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel, int freq,
+		int ratio, nsec_t duration)
 {
 	update(ts);
 	for (int i = 0; i < mNumChans; ++i) {
@@ -28,35 +33,36 @@ bool StdoutDriver::addNote(double ts, double starttime, int lchannel, int freq,
 		chan.ratio = ratio;
 		chan.lchannel = lchannel;
 		chan.stoptime = starttime + duration;
-		printf("%.4f: Add chan=%d lchan=%d freq=%d ratio=%d "
-				"start=%.4f duration=%.4f\n", ts, i, lchannel,
-				freq, ratio, starttime, duration);
+		log_printf("%.4f: Add chan=%d lchan=%d freq=%d ratio=%d "
+				"start=%.4f duration=%.4f\n", ns_to_sec(ts), i,
+				lchannel, freq, ratio, ns_to_sec(starttime),
+				ns_to_sec(duration));
 		return true;
 	}
-	printf("%.4f: !!! No free channel!\n", ts);
+	log_printf("%.4f: !!! No free channel!\n", ns_to_sec(ts));
 	return false;
 }
 
-void StdoutDriver::update(double ts)
+void StdoutDriver::update(nsec_t ts)
 {
 	for (int i = 0; i < mNumChans; ++i) {
 		ChannelState& chan(mChans[i]);
 		if (chan.busy && chan.stoptime <= ts) {
-			printf("%.4f: Release chan=%d lchan=%d "
-					"stoptime=%.4f\n", ts, i, chan.lchannel,
-					chan.stoptime);
+			log_printf("%.4f: Release chan=%d lchan=%d "
+					"stoptime=%.4f\n", ns_to_sec(ts), i,
+					chan.lchannel, ns_to_sec(chan.stoptime));
 			releaseChannel(i);
 		}
 	}
 }
 
-double StdoutDriver::nextEventTime()
+nsec_t StdoutDriver::nextEventTime()
 {
-	double closest = -1.0;
+	nsec_t closest = -1;
 	for (int i = 0; i < mNumChans; ++i) {
 		ChannelState& chan(mChans[i]);
 		if (chan.busy) {
-			if (closest < 0.0 || chan.stoptime < closest) {
+			if (closest < 0 || chan.stoptime < closest) {
 				closest = chan.stoptime;
 			}
 		}
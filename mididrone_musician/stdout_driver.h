@@ -3,16 +3,17 @@
 
 #include "driver.h"
 
-class StdoutDriver : public Driver
+class StdoutDriver final : public Driver
 {
 public:
 	StdoutDriver();
 	virtual ~StdoutDriver();
 	virtual int channels();
-	virtual bool addNote(double ts, double starrtime, int lchannel,
-			int freq, int ratio, double duration);
-	virtual void update(double ts);
-	virtual double nextEventTime();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starrtime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
 	virtual void releaseChannel(int idx);
 	virtual bool releaseLChannel(int lchan);
 	virtual void panic();
@@ -0,0 +1,39 @@
+#include "sync_filter.h"
+#include <algorithm>
+
+SyncFilter::SyncFilter(Method method, unsigned int window) :
+	mMethod(method),
+	mWindow(window == 0 ? 1 : std::min(window, maxWindow)),
+	mCount(0),
+	mNext(0)
+{
+}
+
+void SyncFilter::addSample(nsec_t offset)
+{
+	mSamples[mNext] = offset;
+	mNext = (mNext + 1) % mWindow;
+	if (mCount < mWindow)
+		mCount++;
+}
+
+nsec_t SyncFilter::value()
+{
+	nsec_t sorted[maxWindow];
+
+	if (mCount == 0)
+		return 0;
+	if (mMethod == MIN_DELAY)
+		return *std::max_element(mSamples, mSamples + mCount);
+
+	std::copy(mSamples, mSamples + mCount, sorted);
+	std::sort(sorted, sorted + mCount);
+	if (mCount % 2)
+		return sorted[mCount / 2];
+	return (sorted[mCount / 2 - 1] + sorted[mCount / 2]) / 2;
+}
+
+unsigned int SyncFilter::samples()
+{
+	return mCount;
+}
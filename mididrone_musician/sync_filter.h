@@ -0,0 +1,33 @@
+#ifndef SYNC_FILTER_H_INCLUDED
+#define SYNC_FILTER_H_INCLUDED
+
+#include "timeline.h"
+
+/* Sliding window filter over clock offset samples (conductor time minus
+ * local time). A sample can only be late, never early: network and
+ * scheduling delays make the offset look smaller than it really is. */
+class SyncFilter
+{
+public:
+	enum Method {
+		/* Median of the window, robust to a few outliers */
+		MEDIAN,
+		/* Largest offset of the window: the least delayed sample */
+		MIN_DELAY,
+	};
+
+	static const unsigned int maxWindow = 64;
+
+	SyncFilter(Method method, unsigned int window);
+	void addSample(nsec_t offset);
+	nsec_t value();
+	unsigned int samples();
+private:
+	Method mMethod;
+	unsigned int mWindow;
+	unsigned int mCount;
+	unsigned int mNext;
+	nsec_t mSamples[maxWindow];
+};
+
+#endif
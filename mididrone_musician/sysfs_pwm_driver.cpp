@@ -0,0 +1,296 @@
+#include "sysfs_pwm_driver.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+SysfsPwmDriver::SysfsPwmDriver(const char *chip, int channels) :
+	mChip(strdup(chip)),
+	mNumChans(channels),
+	mChans(new ChannelState[channels]),
+	mChannels(new Channel[channels]),
+	mArms(channels),
+	mErrors(0)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	for (int i = 0; i < mNumChans; i++)
+		openChannel(i);
+	panic();
+}
+
+SysfsPwmDriver::~SysfsPwmDriver()
+{
+	char path[PATH_MAX];
+	char buf[16];
+	int fd, len;
+
+	for (int i = 0; i < mNumChans; i++) {
+		Channel& channel(mChannels[i]);
+		writeAttr(i, ATTR_DUTY_CYCLE, 0);
+		writeAttr(i, ATTR_ENABLE, 0);
+		for (int attr = 0; attr < NUM_ATTRS; attr++) {
+			if (channel.fds[attr] != -1)
+				close(channel.fds[attr]);
+		}
+		if (!channel.exported)
+			continue;
+		snprintf(path, sizeof(path), "%s/unexport", mChip);
+		fd = open(path, O_WRONLY | O_CLOEXEC);
+		len = snprintf(buf, sizeof(buf), "%d", i);
+		if (fd == -1 || ::write(fd, buf, len) != len)
+			printf("Cannot unexport PWM %d of %s: %s\n", i, mChip,
+					strerror(errno));
+		if (fd != -1)
+			close(fd);
+	}
+	if (mStats.notes) {
+		printf("Sysfs PWM: %lu notes, %lu writes (%.2f per note, "
+				"%.2f at onset), %lu skipped\n", mStats.notes,
+				mStats.writes,
+				(double)mStats.writes / mStats.notes,
+				(double)mStats.onsetWrites / mStats.notes,
+				mStats.skipped);
+	}
+	delete[] mChannels;
+	delete[] mChans;
+	free(mChip);
+}
+
+const char *SysfsPwmDriver::attrName(Attr attr)
+{
+	switch (attr) {
+	case ATTR_PERIOD:
+		return "period";
+	case ATTR_DUTY_CYCLE:
+		return "duty_cycle";
+	case ATTR_ENABLE:
+		return "enable";
+	default:
+		return "?";
+	}
+}
+
+/* A channel which cannot be opened stays unusable, its writes fail */
+void SysfsPwmDriver::openChannel(int idx)
+{
+	Channel& channel(mChannels[idx]);
+	char path[PATH_MAX];
+	char buf[16];
+	int fd, len;
+
+	channel.exported = false;
+	for (int attr = 0; attr < NUM_ATTRS; attr++) {
+		channel.fds[attr] = -1;
+		channel.values[attr] = -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/pwm%d", mChip, idx);
+	if (access(path, F_OK) == -1) {
+		snprintf(path, sizeof(path), "%s/export", mChip);
+		fd = open(path, O_WRONLY | O_CLOEXEC);
+		len = snprintf(buf, sizeof(buf), "%d", idx);
+		if (fd == -1 || ::write(fd, buf, len) != len) {
+			printf("Cannot export PWM %d of %s: %s\n", idx, mChip,
+					strerror(errno));
+			if (fd != -1)
+				close(fd);
+			return;
+		}
+		close(fd);
+		channel.exported = true;
+	}
+
+	for (int attr = 0; attr < NUM_ATTRS; attr++) {
+		snprintf(path, sizeof(path), "%s/pwm%d/%s", mChip, idx,
+				attrName((Attr)attr));
+		channel.fds[attr] = open(path, O_WRONLY | O_CLOEXEC);
+		if (channel.fds[attr] == -1)
+			printf("open() %s failed: %s\n", path,
+					strerror(errno));
+	}
+}
+
+/* Failures are counted, and the value is then unknown */
+bool SysfsPwmDriver::writeAttr(int idx, Attr attr, long long value)
+{
+	Channel& channel(mChannels[idx]);
+	char buf[24];
+	int len;
+
+	if (channel.values[attr] == value) {
+		mStats.skipped++;
+		return true;
+	}
+	len = snprintf(buf, sizeof(buf), "%lld\n", value);
+	mStats.writes++;
+	if (pwrite(channel.fds[attr], buf, len, 0) != len) {
+		channel.values[attr] = -1;
+		mErrors.fetch_add(1, std::memory_order_relaxed);
+		printf("Writing pwm%d/%s failed: %s\n", idx,
+				attrName(attr), strerror(errno));
+		return false;
+	}
+	channel.values[attr] = value;
+	return true;
+}
+
+/* The duty cycle may never exceed the period: lower it first when
+ * needed, free channels have it at 0 anyway */
+bool SysfsPwmDriver::setPeriod(int idx, int freq)
+{
+	Channel& channel(mChannels[idx]);
+	long long period = freq > 0 ? NSEC_PER_SEC / freq : 0;
+
+	if (channel.values[ATTR_PERIOD] == period) {
+		mStats.skipped++;
+		return true;
+	}
+	if (channel.values[ATTR_DUTY_CYCLE] != 0 &&
+			!writeAttr(idx, ATTR_DUTY_CYCLE, 0))
+		return false;
+	return writeAttr(idx, ATTR_PERIOD, period);
+}
+
+void SysfsPwmDriver::applyChannelCfg(int idx)
+{
+	ChannelState& chan = mChans[idx];
+	long long period, ratio;
+
+	if (!setPeriod(idx, chan.freq))
+		return;
+	period = mChannels[idx].values[ATTR_PERIOD];
+	ratio = chan.ratio < DRIVER_RATIO_MAX ? chan.ratio : DRIVER_RATIO_MAX;
+	writeAttr(idx, ATTR_DUTY_CYCLE, period * ratio / DRIVER_RATIO_MAX);
+	writeAttr(idx, ATTR_ENABLE, 1);
+}
+
+void SysfsPwmDriver::applyChannelRelease(int idx)
+{
+	writeAttr(idx, ATTR_DUTY_CYCLE, 0);
+}
+
+int SysfsPwmDriver::channels()
+{
+	return mNumChans;
+}
+
+ChannelState SysfsPwmDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool SysfsPwmDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	unsigned long writes;
+	bool armed;
+	int idx;
+
+	update(ts);
+	idx = mArms.pick(mChans, lchannel, freq, &armed);
+	if (idx < 0)
+		return false;
+
+	ChannelState& chan(mChans[idx]);
+	chan.busy = true;
+	chan.freq = freq;
+	chan.ratio = ratio;
+	chan.lchannel = lchannel;
+	chan.stoptime = starttime + duration;
+	mArms.noteStarted(idx, starttime);
+	mStats.notes++;
+	/* Armed or not: only what differs gets written */
+	writes = mStats.writes;
+	applyChannelCfg(idx);
+	mStats.onsetWrites += mStats.writes - writes;
+	return true;
+}
+
+void SysfsPwmDriver::update(nsec_t ts)
+{
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.stoptime <= ts)
+			releaseChannel(i);
+	}
+}
+
+nsec_t SysfsPwmDriver::nextEventTime()
+{
+	nsec_t closest = -1;
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy) {
+			if (closest < 0 || chan.stoptime < closest)
+				closest = chan.stoptime;
+		}
+	}
+	return closest;
+}
+
+void SysfsPwmDriver::releaseChannel(int idx)
+{
+	mChans[idx].busy = false;
+	mChans[idx].lchannel = -1;
+	applyChannelRelease(idx);
+}
+
+bool SysfsPwmDriver::releaseLChannel(int lchan)
+{
+	bool success = false;
+	for (int i = 0; i < mNumChans; i ++) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.lchannel == lchan) {
+			releaseChannel(i);
+			success = true;
+		}
+	}
+	return success;
+}
+
+void SysfsPwmDriver::panic()
+{
+	mArms.clear();
+	for (int i = 0; i < mNumChans; i ++) {
+		releaseChannel(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+}
+
+bool SysfsPwmDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq)
+{
+	long long period = freq > 0 ? NSEC_PER_SEC / freq : 0;
+	bool done;
+	int idx;
+
+	update(ts);
+	/* Best is a channel at that period already */
+	idx = mArms.pickFree(mChans, starttime, lchannel, freq, &done,
+			[this, period](int i) {
+				return mChannels[i].values[ATTR_PERIOD] ==
+					period;
+			});
+	if (idx < 0)
+		return done;
+
+	if (!setPeriod(idx, freq) || !writeAttr(idx, ATTR_ENABLE, 1))
+		return false;
+
+	mArms.arm(idx, starttime, lchannel, freq);
+	return true;
+}
+
+unsigned long SysfsPwmDriver::errors()
+{
+	return mErrors.load(std::memory_order_relaxed);
+}
+
+const SysfsPwmDriver::Stats& SysfsPwmDriver::stats() const
+{
+	return mStats;
+}
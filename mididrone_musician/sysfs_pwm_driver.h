@@ -0,0 +1,76 @@
+#ifndef SYSFS_PWM_DRIVER_H_INCLUDED
+#define SYSFS_PWM_DRIVER_H_INCLUDED
+
+#include <atomic>
+#include "driver.h"
+#include "channel_arms.h"
+
+/* Driver for the standard Linux PWM sysfs interface, for mainline boards:
+ * channel N of the chip is /sys/class/pwm/pwmchipX/pwmN, exported on
+ * creation when needed, and driven through its period, duty_cycle and
+ * enable attributes.
+ * The attribute files stay open, values are written with a single
+ * pwrite(), and a value the attribute already has is not written again:
+ * with arming, a note onset is a single duty_cycle write. The chip path
+ * can as well be a fake tree of regular files. */
+class SysfsPwmDriver final : public Driver
+{
+public:
+	struct Stats {
+		unsigned long notes;
+		unsigned long writes;
+		unsigned long onsetWrites; // Made by addNote()
+		unsigned long skipped; // Value already set
+	};
+
+	/* chip: directory of the PWM chip, e.g. /sys/class/pwm/pwmchip0 */
+	SysfsPwmDriver(const char *chip, int channels);
+	virtual ~SysfsPwmDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
+	const Stats& stats() const;
+private:
+	enum Attr {
+		ATTR_PERIOD,
+		ATTR_DUTY_CYCLE,
+		ATTR_ENABLE,
+		NUM_ATTRS,
+	};
+
+	struct Channel {
+		int fds[NUM_ATTRS];
+		/* Last value written, -1 when unknown */
+		long long values[NUM_ATTRS];
+		bool exported; // By this driver
+	};
+
+	static const char *attrName(Attr attr);
+	void openChannel(int idx);
+	bool writeAttr(int idx, Attr attr, long long value);
+	bool setPeriod(int idx, int freq);
+	void applyChannelCfg(int idx);
+	void applyChannelRelease(int idx);
+
+	char *mChip;
+	int mNumChans;
+	ChannelState *mChans;
+	Channel *mChannels;
+	/* Armed channels are enabled at their period, with a zero duty
+	 * cycle */
+	ChannelArms mArms;
+	Stats mStats;
+	/* Read from the scheduler thread with the output thread */
+	std::atomic<unsigned long> mErrors;
+};
+
+#endif
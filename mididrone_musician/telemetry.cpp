@@ -0,0 +1,139 @@
+#include "telemetry.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <climits>
+#include <cstring>
+
+static int32_t clamp_int32(nsec_t val)
+{
+	if (val > INT32_MAX)
+		return INT32_MAX;
+	if (val < INT32_MIN)
+		return INT32_MIN;
+	return (int32_t)val;
+}
+
+static uint32_t clamp_uint32(unsigned long val)
+{
+	return val > UINT32_MAX ? UINT32_MAX : (uint32_t)val;
+}
+
+Telemetry::Telemetry(int sock, nsec_t period) :
+	mSock(sock),
+	mPeriod(period),
+	mHasConductor(false),
+	mConductor(),
+	mId((uint32_t)getpid()),
+	mSeq(0),
+	mSamples(0),
+	mSent(0),
+	mFailed(0)
+{
+	memset(mCounts, 0, sizeof(mCounts));
+}
+
+nsec_t Telemetry::period() const
+{
+	return mPeriod;
+}
+
+void Telemetry::setConductor(const struct sockaddr_in *addr)
+{
+	mConductor = *addr;
+	mHasConductor = true;
+}
+
+/* Microseconds below 16 have their own bucket, above it the 8 buckets of
+ * an octave are indexed by the 3 bits following the most significant. */
+unsigned int Telemetry::bucket(nsec_t late)
+{
+	uint32_t us;
+	unsigned int shift;
+
+	if (late <= 0)
+		return 0;
+	late /= 1000;
+	us = late >= (1 << 24) ? (1 << 24) - 1 : (uint32_t)late;
+	if (us < 2 * mSubBuckets)
+		return us;
+	shift = 31 - __builtin_clz(us) - 3;
+	return (shift + 1) * mSubBuckets + ((us >> shift) & (mSubBuckets - 1));
+}
+
+uint32_t Telemetry::bucketMax(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < 2 * mSubBuckets)
+		return idx;
+	shift = idx / mSubBuckets - 1;
+	return ((mSubBuckets + idx % mSubBuckets) << shift) +
+		(1u << shift) - 1;
+}
+
+void Telemetry::addLateness(nsec_t late)
+{
+	mCounts[bucket(late)]++;
+	mSamples++;
+}
+
+/* Upper bound of the bucket holding the 99th percentile */
+uint32_t Telemetry::latenessP99() const
+{
+	unsigned long rank = (mSamples * 99 + 99) / 100;
+	unsigned long count = 0;
+
+	if (mSamples == 0)
+		return 0;
+	for (unsigned int i = 0; i < mNumBuckets; i++) {
+		count += mCounts[i];
+		if (count >= rank)
+			return bucketMax(i);
+	}
+	return bucketMax(mNumBuckets - 1);
+}
+
+bool Telemetry::send(const Status& status)
+{
+	struct status_msg msg;
+	ssize_t res;
+
+	if (!mHasConductor)
+		return false;
+	msg.magic = htonl(STATUS_MAGIC);
+	msg.id = htonl(mId);
+	msg.seq = htonl(mSeq++);
+	msg.state = htonl(status.ended ? STATUS_ENDED : STATUS_PLAYING);
+	msg.position_ms = (int32_t)htonl((uint32_t)clamp_int32(
+				status.position / NSEC_PER_MSEC));
+	msg.offset_us = (int32_t)htonl((uint32_t)clamp_int32(
+				status.offset / 1000));
+	msg.late_p99_us = htonl(latenessP99());
+	msg.events = htonl(clamp_uint32(status.events));
+	msg.dropped = htonl(clamp_uint32(status.dropped));
+	msg.errors = htonl(clamp_uint32(status.errors));
+
+	memset(mCounts, 0, sizeof(mCounts));
+	mSamples = 0;
+
+	res = sendto(mSock, &msg, sizeof(msg), MSG_DONTWAIT,
+			(const struct sockaddr *)&mConductor,
+			sizeof(mConductor));
+	if (res != (ssize_t)sizeof(msg)) {
+		mFailed++;
+		return false;
+	}
+	mSent++;
+	return true;
+}
+
+unsigned long Telemetry::sent() const
+{
+	return mSent;
+}
+
+unsigned long Telemetry::failed() const
+{
+	return mFailed;
+}
@@ -0,0 +1,57 @@
+#ifndef TELEMETRY_H_INCLUDED
+#define TELEMETRY_H_INCLUDED
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <proto.h>
+#include "timeline.h"
+
+/* Periodic status reports to the conductor (see proto.h), sent to the
+ * address its packets come from.
+ * Wakeup lateness goes into a log-linear histogram (8 buckets per octave
+ * of microseconds), so that recording a sample is a few instructions and
+ * the p99 of a period is read without sorting. Reports are sent without
+ * blocking: a full socket buffer only loses the report. */
+class Telemetry
+{
+public:
+	struct Status {
+		bool ended;
+		nsec_t position;
+		nsec_t offset;
+		unsigned long events;
+		unsigned long dropped;
+		unsigned long errors;
+	};
+
+	Telemetry(int sock, nsec_t period);
+	nsec_t period() const;
+	void setConductor(const struct sockaddr_in *addr);
+	void addLateness(nsec_t late);
+	/* Send a report, and start a new lateness period. Returns false when
+	 * it could not be sent, or there is no conductor yet. */
+	bool send(const Status& status);
+	unsigned long sent() const;
+	unsigned long failed() const;
+private:
+	static const unsigned int mSubBuckets = 8;
+	/* Up to 2^24 us, about 16 s */
+	static const unsigned int mNumBuckets = 22 * mSubBuckets;
+
+	static unsigned int bucket(nsec_t late);
+	static uint32_t bucketMax(unsigned int idx);
+	uint32_t latenessP99() const;
+
+	int mSock;
+	nsec_t mPeriod;
+	bool mHasConductor;
+	struct sockaddr_in mConductor;
+	uint32_t mId;
+	uint32_t mSeq;
+	unsigned long mSamples;
+	unsigned int mCounts[mNumBuckets];
+	unsigned long mSent;
+	unsigned long mFailed;
+};
+
+#endif
@@ -0,0 +1,380 @@
+#include "threaded_driver.h"
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <futils/futils.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+static bool deadline_reached(const struct timespec *deadline,
+		struct timespec *remaining)
+{
+	struct timespec now;
+	time_get_monotonic(&now);
+	if (now.tv_sec > deadline->tv_sec ||
+	    (now.tv_sec == deadline->tv_sec &&
+	     now.tv_nsec >= deadline->tv_nsec))
+		return true;
+
+	remaining->tv_sec = deadline->tv_sec - now.tv_sec;
+	remaining->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (remaining->tv_nsec < 0) {
+		remaining->tv_sec--;
+		remaining->tv_nsec += 1000000000;
+	}
+	return false;
+}
+
+ThreadedDriver::ThreadedDriver(Driver *driver, DeadlineFn deadline, int prio,
+		int cpu) :
+	mDriver(driver),
+	mDeadline(deadline),
+	mPrio(prio),
+	mCpu(cpu),
+	mRing(),
+	mThread(),
+	mStarted(false),
+	mEventFd(-1),
+	mStop(false),
+	mWaiting(false),
+	mOverruns(0),
+	mNumChans(driver->channels()),
+	mChans(new ChannelState[driver->channels()])
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		mirrorRelease(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+}
+
+ThreadedDriver::~ThreadedDriver()
+{
+	if (mStarted) {
+		uint64_t val = 1;
+		mStop.store(true);
+		if (write(mEventFd, &val, sizeof(val)) == -1)
+			printf("write() to output thread failed: %s\n",
+					strerror(errno));
+		pthread_join(mThread, NULL);
+	}
+	if (mEventFd != -1)
+		close(mEventFd);
+
+	/* Make sure nothing keeps playing. */
+	mDriver->panic();
+	if (mOverruns)
+		printf("Output thread: %u commands dropped (ring full)\n",
+				mOverruns);
+	delete mDriver;
+	delete[] mChans;
+}
+
+bool ThreadedDriver::start()
+{
+	int res;
+	pthread_attr_t attr;
+
+	mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mEventFd == -1) {
+		printf("eventfd() failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	pthread_attr_init(&attr);
+	if (mPrio > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = mPrio;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	res = pthread_create(&mThread, &attr, threadMain, this);
+	if (res == EPERM && mPrio > 0) {
+		printf("Not allowed to use SCHED_FIFO, "
+				"output thread runs with default policy\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		res = pthread_create(&mThread, &attr, threadMain, this);
+	}
+	pthread_attr_destroy(&attr);
+	if (res != 0) {
+		printf("pthread_create() failed: %s\n", strerror(res));
+		return false;
+	}
+	mStarted = true;
+
+	if (mCpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(mCpu, &cpus);
+		res = pthread_setaffinity_np(mThread, sizeof(cpus), &cpus);
+		if (res != 0) {
+			printf("pthread_setaffinity_np(%d) failed: %s\n",
+					mCpu, strerror(res));
+		}
+	}
+	return true;
+}
+
+void* ThreadedDriver::threadMain(void *arg)
+{
+	sigset_t sigs;
+
+	/* Signals are for the main loop */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	static_cast<ThreadedDriver*>(arg)->run();
+	return NULL;
+}
+
+void ThreadedDriver::run()
+{
+	/* Commands are posted at most the scheduling lead ahead of their
+	 * deadline, so draining the ring on stop does not take long. */
+	for (;;) {
+		struct timespec remaining;
+		Command *cmd = mRing.front();
+		if (!cmd) {
+			if (mStop.load())
+				break;
+			wait(NULL);
+			continue;
+		}
+		if (!deadline_reached(&cmd->deadline, &remaining)) {
+			wait(&remaining);
+			continue;
+		}
+		execute(*cmd);
+		mRing.pop();
+	}
+}
+
+/* Wait for a new command when timeout is NULL, or for the timeout to
+ * elapse. Either way, a stop request interrupts the wait. */
+void ThreadedDriver::wait(const struct timespec *timeout)
+{
+	struct pollfd pfd;
+	uint64_t val;
+
+	if (!timeout) {
+		mWaiting.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!mRing.empty()) {
+			mWaiting.store(false);
+			return;
+		}
+	}
+
+	pfd.fd = mEventFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (ppoll(&pfd, 1, timeout, NULL) == -1 && errno != EINTR)
+		printf("ppoll() failed: %s\n", strerror(errno));
+
+	mWaiting.store(false);
+	if (pfd.revents & POLLIN) {
+		if (read(mEventFd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+			printf("read() failed: %s\n", strerror(errno));
+	}
+}
+
+void ThreadedDriver::execute(const Command& cmd)
+{
+	switch (cmd.type) {
+	case CMD_ADD_NOTE:
+		mDriver->addNote(cmd.ts, cmd.starttime, cmd.arg, cmd.freq,
+				cmd.ratio, cmd.duration);
+		break;
+	case CMD_UPDATE:
+		mDriver->update(cmd.ts);
+		break;
+	case CMD_RELEASE:
+		mDriver->releaseChannel(cmd.arg);
+		break;
+	case CMD_RELEASE_LCHANNEL:
+		mDriver->releaseLChannel(cmd.arg);
+		break;
+	case CMD_PANIC:
+		mDriver->panic();
+		break;
+	case CMD_ARM_NOTE:
+		mDriver->armNote(cmd.ts, cmd.starttime, cmd.arg, cmd.freq);
+		break;
+	}
+}
+
+void ThreadedDriver::post(CommandType type, nsec_t ts, int arg)
+{
+	Command cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type = type;
+	cmd.ts = ts;
+	cmd.arg = arg;
+	post(cmd);
+}
+
+void ThreadedDriver::post(Command& cmd)
+{
+	mDeadline(cmd.ts, &cmd.deadline);
+	if (!mRing.push(cmd)) {
+		mOverruns++;
+		return;
+	}
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mWaiting.exchange(false)) {
+		uint64_t val = 1;
+		if (write(mEventFd, &val, sizeof(val)) == -1)
+			printf("write() to output thread failed: %s\n",
+					strerror(errno));
+	}
+}
+
+void ThreadedDriver::mirrorRelease(int idx)
+{
+	mChans[idx].busy = false;
+	mChans[idx].lchannel = -1;
+}
+
+int ThreadedDriver::channels()
+{
+	return mNumChans;
+}
+
+ChannelState ThreadedDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool ThreadedDriver::addNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq, int ratio, nsec_t duration)
+{
+	Command cmd;
+	bool found = false;
+
+	/* Commands must be posted in deadline order: only flush the releases
+	 * due before this note, later ones are posted by update(). */
+	update(starttime);
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy)
+			continue;
+		chan.busy = true;
+		chan.freq = freq;
+		chan.ratio = ratio;
+		chan.lchannel = lchannel;
+		chan.stoptime = starttime + duration;
+		found = true;
+		break;
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type = CMD_ADD_NOTE;
+	cmd.ts = starttime;
+	cmd.starttime = starttime;
+	cmd.duration = duration;
+	cmd.arg = lchannel;
+	cmd.freq = freq;
+	cmd.ratio = ratio;
+	post(cmd);
+	return found;
+}
+
+void ThreadedDriver::update(nsec_t ts)
+{
+	for (;;) {
+		int first = -1;
+		for (int i = 0; i < mNumChans; ++i) {
+			ChannelState& chan(mChans[i]);
+			if (!chan.busy || chan.stoptime > ts)
+				continue;
+			if (first < 0 || chan.stoptime < mChans[first].stoptime)
+				first = i;
+		}
+		if (first < 0)
+			return;
+		/* Fire each release at its own stop time, earliest first */
+		post(CMD_UPDATE, mChans[first].stoptime, 0);
+		mirrorRelease(first);
+	}
+}
+
+nsec_t ThreadedDriver::nextEventTime()
+{
+	nsec_t closest = -1;
+	for (int i = 0; i < mNumChans; ++i) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy) {
+			if (closest < 0 || chan.stoptime < closest) {
+				closest = chan.stoptime;
+			}
+		}
+	}
+	return closest;
+}
+
+void ThreadedDriver::releaseChannel(int idx)
+{
+	mirrorRelease(idx);
+	post(CMD_RELEASE, 0, idx);
+}
+
+bool ThreadedDriver::releaseLChannel(int lchan)
+{
+	bool success = false;
+	for (int i = 0; i < mNumChans; i ++) {
+		ChannelState& chan(mChans[i]);
+		if (chan.busy && chan.lchannel == lchan) {
+			mirrorRelease(i);
+			success = true;
+		}
+	}
+	post(CMD_RELEASE_LCHANNEL, 0, lchan);
+	return success;
+}
+
+void ThreadedDriver::panic()
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		mirrorRelease(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+	post(CMD_PANIC, 0, 0);
+}
+
+/* Armed by the output thread at ts, in its idle time before the note.
+ * Without a free channel, the scheduler tries again on its next wakeup. */
+bool ThreadedDriver::armNote(nsec_t ts, nsec_t starttime, int lchannel,
+		int freq)
+{
+	Command cmd;
+	int i;
+
+	update(ts);
+	for (i = 0; i < mNumChans; ++i) {
+		if (!mChans[i].busy)
+			break;
+	}
+	if (i == mNumChans)
+		return false;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type = CMD_ARM_NOTE;
+	cmd.ts = ts;
+	cmd.starttime = starttime;
+	cmd.arg = lchannel;
+	cmd.freq = freq;
+	post(cmd);
+	return true;
+}
+
+/* Commands dropped here, and the hardware failures of the output thread */
+unsigned long ThreadedDriver::errors()
+{
+	return mOverruns + mDriver->errors();
+}
@@ -0,0 +1,85 @@
+#ifndef THREADED_DRIVER_H_INCLUDED
+#define THREADED_DRIVER_H_INCLUDED
+
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include "driver.h"
+#include "spsc_ring.h"
+
+/* Driver wrapper moving all the calls to the wrapped driver to a dedicated
+ * output thread. The scheduler thread posts timestamped commands into a
+ * SPSC ring, and the output thread fires each of them on the wrapped driver
+ * at its deadline.
+ * Channel allocation is mirrored locally, so that addNote() and
+ * nextEventTime() answer immediately, without waiting for the output
+ * thread. */
+class ThreadedDriver : public Driver
+{
+public:
+	/* Convert a song timestamp to an absolute CLOCK_MONOTONIC deadline */
+	typedef void (*DeadlineFn)(nsec_t ts, struct timespec *deadline);
+
+	/* Takes ownership of driver. prio > 0 requests SCHED_FIFO with that
+	 * priority, cpu >= 0 pins the output thread on that CPU. */
+	ThreadedDriver(Driver *driver, DeadlineFn deadline, int prio, int cpu);
+	virtual ~ThreadedDriver();
+	bool start();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration);
+	virtual void update(nsec_t ts);
+	virtual nsec_t nextEventTime();
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+	virtual bool armNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq);
+	virtual unsigned long errors();
+private:
+	enum CommandType {
+		CMD_ADD_NOTE,
+		CMD_UPDATE,
+		CMD_RELEASE,
+		CMD_RELEASE_LCHANNEL,
+		CMD_PANIC,
+		CMD_ARM_NOTE,
+	};
+
+	struct Command {
+		CommandType type;
+		struct timespec deadline;
+		nsec_t ts;
+		nsec_t starttime;
+		nsec_t duration;
+		int arg; // Channel or logical channel
+		int freq;
+		int ratio;
+	};
+
+	static void* threadMain(void *arg);
+	void run();
+	void wait(const struct timespec *deadline);
+	void execute(const Command& cmd);
+	void post(CommandType type, nsec_t ts, int arg);
+	void post(Command& cmd);
+	void mirrorRelease(int idx);
+
+	static const unsigned int mRingSize = 256;
+	Driver *mDriver;
+	DeadlineFn mDeadline;
+	int mPrio;
+	int mCpu;
+	SpscRing<Command, mRingSize> mRing;
+	pthread_t mThread;
+	bool mStarted;
+	int mEventFd;
+	std::atomic<bool> mStop;
+	std::atomic<bool> mWaiting;
+	unsigned int mOverruns;
+	int mNumChans;
+	ChannelState *mChans;
+};
+
+#endif
@@ -6,11 +6,15 @@ LOCAL_CATEGORY_PATH := mididrone
 LOCAL_DESCRIPTION := Play a MIDI file on the drone
 LOCAL_SRC_FILES := \
 	mididrone_player.cpp \
-	stdout_driver.cpp
+	recording_driver.cpp \
+	render_driver.cpp \
+	stdout_driver.cpp \
+	voice_allocator.cpp
 
-LOCAL_LIBRARIES := portsmf
+LOCAL_LIBRARIES := portsmf libmididrone_trace libmididrone_render
 LOCAL_CFLAGS := -std=gnu99
 LOCAL_CXXFLAGS := -std=c++0x
+LOCAL_LDLIBS := -lrt
 
 ifeq ("$(TARGET_CPU)","p6i")
 LOCAL_DEPENDS_HEADERS := linux
@@ -1,6 +1,10 @@
 #ifndef DRIVER_H_INCLUDED
 #define DRIVER_H_INCLUDED
 
+/* Channel ratio at a 100% duty cycle: the output is high for
+ * ratio / DRIVER_RATIO_MAX of each period */
+#define DRIVER_RATIO_MAX 256
+
 struct ChannelState
 {
 public:
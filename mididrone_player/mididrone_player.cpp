@@ -1,149 +1,181 @@
 #include <math.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <signal.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
+#include <vector>
 #include <allegro.h>
+#include <probes.h>
+#include "timeline.h"
 #include "driver.h"
 #include "stdout_driver.h"
 #include "pwm_driver.h"
+#include "voice_allocator.h"
+#include "recording_driver.h"
+#include "render_driver.h"
 
-#define ROUND(x) (int) ((x)+0.5)
+/* Records buffered by the driver call trace between two writes */
+#define TRACE_BUFFER_RECORDS 16384
+/* Channels of the render driver, as many as the drone's motors */
+#define RENDER_CHANNELS 4
 
 static volatile bool quit = false;
 
-static double time_sec_offset = 0;
+struct opts {
+	bool ok;
+	unsigned int spin_us;
+	VoiceAllocator::Policy policy;
+	bool replay;
+	const char* trace_file;
+	const char* render_file;
+	const char* filename;
+};
 
-static const char *pressure_attr;
-static const char *bend_attr;
-static const char *program_attr;
+/* CLOCK_MONOTONIC date of the song start */
+static nsec_t time_offset = 0;
+/* Busy wait the last spin nanoseconds before each deadline */
+static nsec_t spin = 0;
+/* How late each event reached the driver */
+static std::vector<nsec_t> lateness;
+/* Rendering: no waiting, the song date jumps from one event to the next */
+static bool offline = false;
+static nsec_t offline_date = 0;
+
+static nsec_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_ns(&ts);
+}
 
 static void init_time()
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	time_sec_offset = (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+	time_offset = monotonic_ns();
 }
 
-static double get_time()
+static nsec_t get_time()
 {
-	struct timeval tv;
-	double res;
-	gettimeofday(&tv, NULL);
-	res = (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
-	res -= time_sec_offset;
-	return res;
+	return monotonic_ns() - time_offset;
 }
 
-static void wait_until(double time)
+/* Sleep until an absolute date, so that wakeup overshoot does not add up
+ * from one event to the next, then spin for the last microseconds. */
+static void wait_until(nsec_t time)
 {
-	double now;
-	do {
-		now = get_time();
-		//printf("now: %f\n", now);
-		if (time - now >= 1.0)
-			sleep((int)(time - now));
-		else if (time - now > 0.0)
-			usleep((time - now) * 1000000.0);
-	} while (now < time);
+	struct timespec deadline;
+	int res;
+
+	if (time - spin > get_time()) {
+		ns_to_timespec(time - spin + time_offset, &deadline);
+		do {
+			res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&deadline, NULL);
+		} while (res == EINTR && !quit);
+		if (res != 0 && res != EINTR)
+			printf("clock_nanosleep() failed: %s\n", strerror(res));
+	}
+	while (!quit && get_time() < time)
+		;
 }
 
-static int key2freq(int key)
+/* Wait for the date of an event, and record how late it was reached */
+static void reach(nsec_t date)
 {
-	double freq = pow(2.0, ((double)key - 69.0) / 12.0) * 440.0;
-	//printf("key2freq: %i -> %i\n", key, (int)round(freq));
-	return (int)round(freq);
+	if (offline) {
+		offline_date = date;
+		return;
+	}
+	wait_until(date);
+	nsec_t late = get_time() - date;
+	MIDIDRONE_PROBE2(reach, date, late);
+	lateness.push_back(late);
 }
 
-static int loud2ratio(int loud)
+static nsec_t song_date()
 {
-	return loud * 2;
+	return offline ? offline_date : get_time();
 }
 
-static void midi_note_on(Driver *driver, double when, int chan, int key, int loud)
+static void print_lateness()
 {
-	unsigned long timestamp = (unsigned long) (when * 1000);
-	chan = chan & 15;
-	if (key > 127) key = 127;
-	if (key < 0) key = 0;
-	if (loud > 127) loud = 127;
-	if (loud < 0) loud = 0;
-
-	ChannelState cs;
-	cs.freq = key2freq(key);
-	cs.ratio = loud2ratio(loud);
-	cs.lchannel = chan;
-	if (loud == 0) {
-		driver->releaseLChannel(chan);
-	}
-	driver->setFirstFreeChannelState(cs);
+	nsec_t sum = 0;
+	size_t count = lateness.size();
+
+	if (count == 0)
+		return;
+	std::sort(lateness.begin(), lateness.end());
+	for (auto it = lateness.begin(); it != lateness.end(); ++it)
+		sum += *it;
+	printf("Lateness over %zu events (us): mean %.1f p50 %.1f "
+			"p99 %.1f max %.1f\n", count,
+			(double)sum / (double)count / 1000.0,
+			(double)lateness[count / 2] / 1000.0,
+			(double)lateness[(size_t)ceil(0.99 * count) - 1] / 1000.0,
+			(double)lateness.back() / 1000.0);
 }
 
-#if UPDATE
-void send_midi_update(Alg_update_ptr u, Driver* driver)
+/* Replay the pre-resolved driver calls at their dates. With a final
+ * driver class, the calls are made without indirection. */
+template <class D>
+static void play(const std::vector<VoiceCommand>& commands, D *driver)
 {
-	if (u->get_attribute() == pressure_attr) {
-		if (u->get_identifier() < 0) {
-			midi_channel_message_2(midi, u->time, MIDI_TOUCH, u->chan,
-					(int) (u->get_real_value() * 127));
-		} else {
-			midi_channel_message(midi, u->time, MIDI_POLY_TOUCH, u->chan, 
-					u->get_identifier(), 
-					(int) (u->get_real_value() * 127));
+	driver->panic(); // Reset driver
+
+	for (auto it = commands.begin(); it != commands.end() && !quit; ++it) {
+		reach(it->date);
+		MIDIDRONE_PROBE3(command, it->date, (int)it->type, it->channel);
+		switch (it->type) {
+		case VoiceCommand::START:
+			driver->setChannelState(it->channel, it->state);
+			break;
+		case VoiceCommand::STOP:
+			driver->releaseChannel(it->channel);
+			break;
 		}
-	} else if (u->get_attribute() == bend_attr) {
-		int bend = ROUND((u->get_real_value() + 1) * 8192);
-		if (bend > 8191) bend = 8191;
-		if (bend < 0) bend = 0;
-		midi_channel_message(midi, u->time, MIDI_BEND, u->chan, 
-				bend >> 7, bend & 0x7F);
-	} else if (u->get_attribute() == program_attr) {
-		midi_channel_message_2(midi, u->time, MIDI_CH_PROGRAM, 
-				u->chan, u->get_integer_value());
-	} else if (strncmp("control", u->get_attribute(), 7) == 0 &&
-			u->get_update_type() == 'r') {
-		int control = atoi(u->get_attribute() + 7);
-		int val = ROUND(u->get_real_value() * 127);
-		midi_channel_message(midi, u->time, MIDI_CTRL, u->chan, control, val);
 	}
 }
-#endif
 
-static void seq2midi(Alg_seq &seq, Driver *driver)
+/* Make the driver calls of a trace recorded with -T, at their recorded
+ * dates. The whole trace is read before starting. */
+static int replay_trace(const char *path, Driver *driver)
 {
-	// prepare by doing lookup of important symbols
-	pressure_attr = symbol_table.insert_string("pressurer") + 1;
-	bend_attr = symbol_table.insert_string("bendr") + 1;
-	program_attr = symbol_table.insert_string("programi") + 1;
-
-	Alg_iterator iterator(&seq, true);
-	iterator.begin();
-	bool note_on;
-	Alg_event_ptr e = iterator.next(&note_on);
-	driver->panic(); // Reset driver
+	struct trace_reader *reader;
+	struct trace_record record;
+	std::vector<struct trace_record> records;
+	int res;
 
-	while (e && !quit) {
-		double next_time = (note_on ? e->time : e->get_end_time());
-		wait_until(next_time);
-		if (e->is_note() && note_on) { // process notes here
-			// printf("Note at %g: chan %d key %d loud %d\n",
-			//        next_time, e->chan, e->key, (int) e->loud);
-			midi_note_on(driver, next_time, e->chan, e->get_identifier(),
-					(int) e->get_loud());
-		} else if (e->is_note()) { // must be a note off
-			midi_note_on(driver, next_time, e->chan, e->get_identifier(), 0);
-#if UPDATE
-		} else if (e->is_update()) { // process updates here
-			Alg_update_ptr u = (Alg_update_ptr) e; // coerce to proper type
-			send_midi_update(u, driver);
-#endif
-		} 
-		// add next note
-		e = iterator.next(&note_on);
+	reader = trace_reader_new(path);
+	if (!reader)
+		return -1;
+	if (trace_reader_header(reader)->source != TRACE_SOURCE_PLAYER) {
+		printf("%s was not recorded by a player\n", path);
+		trace_reader_destroy(reader);
+		return -1;
+	}
+	while ((res = trace_reader_next(reader, &record)) == 1)
+		records.push_back(record);
+	trace_reader_destroy(reader);
+	if (res < 0) {
+		printf("Failed to read %s\n", path);
+		return -1;
+	}
+
+	lateness.reserve(records.size());
+	init_time();
+	size_t count = 0;
+	for (auto it = records.begin(); it != records.end() && !quit; ++it) {
+		reach(it->date);
+		RecordingDriver::replay(driver, *it);
+		count++;
 	}
-	iterator.end();
+	printf("Replayed %zu driver calls\n", count);
+	return 0;
 }
 
 void sig_handler(int sig)
@@ -151,30 +183,181 @@ void sig_handler(int sig)
 	quit = true;
 }
 
+static void usage(char* arg0)
+{
+	printf("Usage: %s [-S US] [-v POLICY] [-T TRACE] [-W WAV] MIDIFILE\n"
+	       "       %s [-S US] [-T TRACE] [-W WAV] -r TRACE\n",
+	       basename(arg0), basename(arg0));
+	printf("  -h    Show this usage screen and exit\n");
+	printf("  -S US Busy wait the last US microseconds before each\n");
+	printf("        event instead of sleeping (default: 0)\n");
+	printf("  -v POLICY Voice stealing policy, when a note starts while\n");
+	printf("        all the channels are busy:\n");
+	printf("        none      drop the new note\n");
+	printf("        oldest    stop the oldest note (default)\n");
+	printf("        quietest  stop the softest note\n");
+	printf("        lchannel  stop a note of the same MIDI channel,\n");
+	printf("                  or drop the new note\n");
+	printf("  -T TRACE Record every driver call into the binary trace\n");
+	printf("        TRACE (see mididrone_trace)\n");
+	printf("  -W WAV Synthesize the channels into the WAV file WAV\n");
+	printf("        instead of playing them, as fast as possible\n");
+	printf("  -r    Replay: the file argument is a trace recorded with\n");
+	printf("        -T, make its driver calls again at the same dates\n");
+}
+
+static struct opts parse_opts(int argc, char* argv[])
+{
+	struct opts opts = {
+		.ok = false,
+		.spin_us = 0,
+		.policy = VoiceAllocator::STEAL_OLDEST,
+		.replay = false,
+		.trace_file = nullptr,
+		.render_file = nullptr,
+		.filename = nullptr,
+	};
+	int opt = -1;
+
+	while((opt = getopt(argc, argv, ":hrS:T:v:W:")) != -1) {
+		switch(opt) {
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'r':
+			opts.replay = true;
+			break;
+		case 'S':
+		{
+			char *endptr = NULL;
+			long int val = strtol(optarg, &endptr, 0);
+			if (endptr == optarg || *endptr || val < 0 ||
+			    val > 1000000) {
+				printf("Invalid value for -S: %s\n", optarg);
+				return opts;
+			}
+			opts.spin_us = (unsigned int)val;
+			break;
+		}
+		case 'T':
+			opts.trace_file = optarg;
+			break;
+		case 'v':
+			if (!strcmp(optarg, "none")) {
+				opts.policy = VoiceAllocator::STEAL_NONE;
+			} else if (!strcmp(optarg, "oldest")) {
+				opts.policy = VoiceAllocator::STEAL_OLDEST;
+			} else if (!strcmp(optarg, "quietest")) {
+				opts.policy = VoiceAllocator::STEAL_QUIETEST;
+			} else if (!strcmp(optarg, "lchannel")) {
+				opts.policy = VoiceAllocator::STEAL_LCHANNEL;
+			} else {
+				printf("Invalid value for -v: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'W':
+			opts.render_file = optarg;
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if ((argc - optind) != 1) {
+		usage(argv[0]);
+		return opts;
+	}
+
+	opts.filename = argv[optind];
+	opts.ok = true;
+	return opts;
+}
+
 int main(int argc, char* argv[])
 {
-	if (argc != 2) {
-		printf("Usage: %s MIDIFILE\n", basename(argv[0]));
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
 		return 1;
-	}
 
 	signal(SIGINT, sig_handler);
 	signal(SIGQUIT, sig_handler);
 	signal(SIGHUP, sig_handler);
 
-	init_time();
-	Alg_seq seq(argv[1], true);
-	seq.convert_to_seconds();
+	spin = (nsec_t)opts.spin_us * 1000;
+	Driver* driver;
+	/* The backend, when known at compile time */
 #ifdef USE_MINIDRONES_PWM_DRIVER
-	Driver* driver = new PwmDriver();
+	PwmDriver *hardware = NULL;
 #else
-	Driver* driver = new StdoutDriver();
+	StdoutDriver *hardware = NULL;
 #endif
+	if (opts.render_file) {
+		struct render *render = render_new(opts.render_file,
+				RENDER_DEFAULT_RATE, RENDER_CHANNELS);
+		if (!render)
+			return EXIT_FAILURE;
+		printf("Rendering to %s\n", opts.render_file);
+		offline = true;
+		driver = new RenderDriver(render, RENDER_CHANNELS, song_date);
+	} else {
+#ifdef USE_MINIDRONES_PWM_DRIVER
+		hardware = new PwmDriver();
+#else
+		hardware = new StdoutDriver();
+#endif
+		driver = hardware;
+	}
+
+	if (opts.trace_file) {
+		struct trace_writer *writer = trace_writer_new(opts.trace_file,
+				TRACE_SOURCE_PLAYER, driver->channels(),
+				TRACE_BUFFER_RECORDS);
+		if (!writer) {
+			delete driver;
+			return EXIT_FAILURE;
+		}
+		driver = new RecordingDriver(driver, writer);
+	}
 
-	printf("Playing: %s\n", argv[1]);
+	if (opts.replay) {
+		printf("Replaying: %s\n", opts.filename);
+		int res = replay_trace(opts.filename, driver);
+		print_lateness();
+		delete driver;
+		return res ? EXIT_FAILURE : 0;
+	}
+
+	Alg_seq seq(opts.filename, true);
+	seq.convert_to_seconds();
+
+	printf("Playing: %s\n", opts.filename);
 	printf("Available channels: %i\n", driver->channels());
 
-	seq2midi(seq, driver);
+	std::vector<VoiceCommand> commands;
+	VoiceAllocator allocator(driver->channels(), opts.policy);
+	allocator.build(seq, commands);
+	printf("Voice allocation: %u notes, %u stolen, %u dropped\n",
+			allocator.notes(), allocator.stolen(),
+			allocator.dropped());
+
+	/* The song starts once loaded, not while loading */
+	lateness.reserve(commands.size());
+	init_time();
+	if (driver == hardware)
+		play(commands, hardware);
+	else
+		play(commands, driver);
+	print_lateness();
 
 	delete(driver);
 	return 0;
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/pwm_ioctl.h>
+#include <probes.h>
 #include <cstring>
 #include <cerrno>
 #include <cstdio>
@@ -77,6 +78,7 @@ bool PwmDriver::setChannelState(int idx, ChannelState state)
 	chan = state;
 	chan.busy = true;
 
+	MIDIDRONE_PROBE3(pwm_set_start, idx, state.freq, state.ratio);
 	pwmdata = 0;
 	res = ioctl(mFds[idx], PWM_SET_WIDTH, &pwmdata);
 	if (res == -1) {
@@ -99,6 +101,7 @@ bool PwmDriver::setChannelState(int idx, ChannelState state)
 	if (res == -1) {
 		printf("ioctl PWM_START failed: %s\n", strerror(errno));
 	}
+	MIDIDRONE_PROBE1(pwm_set_done, idx);
 
 	return true;
 }
@@ -110,6 +113,7 @@ void PwmDriver::releaseChannel(int idx)
 	mChans[idx].busy = false;
 	mChans[idx].lchannel = -1;
 
+	MIDIDRONE_PROBE1(pwm_release_start, idx);
 	pwmdata = 0;
 	res = ioctl(mFds[idx], PWM_SET_WIDTH, &pwmdata);
 	if (res == -1) {
@@ -120,6 +124,7 @@ void PwmDriver::releaseChannel(int idx)
 	if (res == -1) {
 		printf("ioctl PWM_STOP failed: %s\n", strerror(errno));
 	}
+	MIDIDRONE_PROBE1(pwm_release_done, idx);
 }
 
 bool PwmDriver::releaseLChannel(int lchan)
@@ -3,7 +3,7 @@
 
 #include "driver.h"
 
-class PwmDriver : public Driver
+class PwmDriver final : public Driver
 {
 public:
 	PwmDriver();
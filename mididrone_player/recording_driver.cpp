@@ -0,0 +1,117 @@
+#include "recording_driver.h"
+#include <cstring>
+#include <cstdio>
+
+RecordingDriver::RecordingDriver(Driver *driver, struct trace_writer *writer) :
+	mDriver(driver),
+	mWriter(writer)
+{
+}
+
+RecordingDriver::~RecordingDriver()
+{
+	unsigned long lost = trace_writer_destroy(mWriter);
+	if (lost)
+		printf("Trace: %lu records lost\n", lost);
+	delete mDriver;
+}
+
+/* date is taken before the call, the record is added after it */
+void RecordingDriver::record(uint16_t type, int64_t date, int channel,
+		const ChannelState *state, int lchannel, bool result)
+{
+	struct trace_record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.date = date;
+	rec.ts = -1;
+	rec.type = type;
+	rec.channel = (int16_t)channel;
+	rec.lchannel = (int16_t)lchannel;
+	if (state) {
+		rec.lchannel = (int16_t)state->lchannel;
+		rec.freq = (uint32_t)state->freq;
+		rec.ratio = (uint16_t)state->ratio;
+	}
+	rec.result = result;
+	trace_writer_add(mWriter, &rec);
+}
+
+int RecordingDriver::channels()
+{
+	return mDriver->channels();
+}
+
+ChannelState RecordingDriver::channelState(int idx)
+{
+	return mDriver->channelState(idx);
+}
+
+bool RecordingDriver::setFirstFreeChannelState(ChannelState state)
+{
+	int64_t date = trace_writer_date(mWriter);
+	bool res = mDriver->setFirstFreeChannelState(state);
+	record(TRACE_SET_FIRST_FREE, date, -1, &state, -1, res);
+	return res;
+}
+
+bool RecordingDriver::setChannelState(int idx, ChannelState state)
+{
+	int64_t date = trace_writer_date(mWriter);
+	bool res = mDriver->setChannelState(idx, state);
+	record(TRACE_SET_CHANNEL, date, idx, &state, -1, res);
+	return res;
+}
+
+void RecordingDriver::releaseChannel(int idx)
+{
+	int64_t date = trace_writer_date(mWriter);
+	mDriver->releaseChannel(idx);
+	record(TRACE_RELEASE, date, idx, NULL, -1, true);
+}
+
+bool RecordingDriver::releaseLChannel(int lchan)
+{
+	int64_t date = trace_writer_date(mWriter);
+	bool res = mDriver->releaseLChannel(lchan);
+	record(TRACE_RELEASE_LCHANNEL, date, -1, NULL, lchan, res);
+	return res;
+}
+
+void RecordingDriver::panic()
+{
+	int64_t date = trace_writer_date(mWriter);
+	mDriver->panic();
+	record(TRACE_PANIC, date, -1, NULL, -1, true);
+}
+
+void RecordingDriver::replay(Driver *driver, const struct trace_record& record)
+{
+	ChannelState state;
+
+	memset(&state, 0, sizeof(state));
+	state.lchannel = record.lchannel;
+	state.freq = (int)record.freq;
+	state.ratio = record.ratio;
+
+	switch (record.type) {
+	case TRACE_SET_FIRST_FREE:
+		driver->setFirstFreeChannelState(state);
+		break;
+	case TRACE_SET_CHANNEL:
+		driver->setChannelState(record.channel, state);
+		break;
+	case TRACE_RELEASE:
+		driver->releaseChannel(record.channel);
+		break;
+	case TRACE_RELEASE_LCHANNEL:
+		driver->releaseLChannel(record.lchannel);
+		break;
+	case TRACE_PANIC:
+		driver->panic();
+		break;
+	default:
+		printf("Trace: unexpected %s record\n",
+				trace_type_str(record.type));
+		break;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef RECORDING_DRIVER_H_INCLUDED
+#define RECORDING_DRIVER_H_INCLUDED
+
+#include <trace.h>
+#include "driver.h"
+
+/* Driver wrapper recording every call made on the wrapped driver, with
+ * its date, into a binary trace (see libmididrone_trace). */
+class RecordingDriver : public Driver
+{
+public:
+	/* Takes ownership of driver and writer */
+	RecordingDriver(Driver *driver, struct trace_writer *writer);
+	virtual ~RecordingDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool setFirstFreeChannelState(ChannelState state);
+	virtual bool setChannelState(int idx, ChannelState state);
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+
+	/* Make the call described by a record of a player trace */
+	static void replay(Driver *driver, const struct trace_record& record);
+private:
+	void record(uint16_t type, int64_t date, int channel,
+			const ChannelState *state, int lchannel, bool result);
+
+	Driver *mDriver;
+	struct trace_writer *mWriter;
+};
+
+#endif
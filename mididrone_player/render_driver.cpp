@@ -0,0 +1,83 @@
+#include "render_driver.h"
+
+/* The render library has its own full scale */
+static int render_ratio(int ratio)
+{
+	return ratio * RENDER_RATIO_MAX / DRIVER_RATIO_MAX;
+}
+
+RenderDriver::RenderDriver(struct render *render, int channels,
+		ClockFn clock) :
+	mRender(render),
+	mNumChans(channels),
+	mChans(new ChannelState[channels]),
+	mClock(clock)
+{
+	panic();
+}
+
+RenderDriver::~RenderDriver()
+{
+	render_destroy(mRender);
+	delete[] mChans;
+}
+
+int RenderDriver::channels()
+{
+	return mNumChans;
+}
+
+ChannelState RenderDriver::channelState(int idx)
+{
+	return mChans[idx];
+}
+
+bool RenderDriver::setFirstFreeChannelState(ChannelState state)
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		if (!mChans[i].busy || mChans[i].lchannel == state.lchannel)
+			return setChannelState(i, state);
+	}
+	return false;
+}
+
+bool RenderDriver::setChannelState(int idx, ChannelState state)
+{
+	ChannelState& chan = mChans[idx];
+	if (chan.busy)
+		return false;
+
+	render_advance(mRender, mClock());
+	chan = state;
+	chan.busy = true;
+	render_set(mRender, idx, chan.freq, render_ratio(chan.ratio));
+	return true;
+}
+
+void RenderDriver::releaseChannel(int idx)
+{
+	render_advance(mRender, mClock());
+	mChans[idx].busy = false;
+	mChans[idx].lchannel = -1;
+	render_set(mRender, idx, 0, 0);
+}
+
+bool RenderDriver::releaseLChannel(int lchan)
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		if (mChans[i].lchannel == lchan) {
+			releaseChannel(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+void RenderDriver::panic()
+{
+	for (int i = 0; i < mNumChans; i ++) {
+		releaseChannel(i);
+		mChans[i].freq = 0;
+		mChans[i].ratio = 0;
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef RENDER_DRIVER_H_INCLUDED
+#define RENDER_DRIVER_H_INCLUDED
+
+#include <render.h>
+#include "timeline.h"
+#include "driver.h"
+
+/* Driver synthesizing the channels into a WAV file instead of playing
+ * them. The calls carry no date: each one is rendered at the song date
+ * the clock function returns. */
+class RenderDriver : public Driver
+{
+public:
+	typedef nsec_t (*ClockFn)();
+
+	/* Takes ownership of render */
+	RenderDriver(struct render *render, int channels, ClockFn clock);
+	virtual ~RenderDriver();
+	virtual int channels();
+	virtual ChannelState channelState(int idx);
+	virtual bool setFirstFreeChannelState(ChannelState state);
+	virtual bool setChannelState(int idx, ChannelState state);
+	virtual void releaseChannel(int idx);
+	virtual bool releaseLChannel(int lchan);
+	virtual void panic();
+private:
+	struct render *mRender;
+	int mNumChans;
+	ChannelState *mChans;
+	ClockFn mClock;
+};
+
+#endif
@@ -3,7 +3,7 @@
 
 #include "driver.h"
 
-class StdoutDriver : public Driver
+class StdoutDriver final : public Driver
 {
 public:
 	StdoutDriver();
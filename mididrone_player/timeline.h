@@ -0,0 +1,44 @@
+#ifndef TIMELINE_H_INCLUDED
+#define TIMELINE_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+/* Song and clock dates are 64-bit integer nanoseconds: no precision loss
+ * on long uptimes, and exact comparisons. Floating point seconds only
+ * come in when decoding the score, and go out in logs. */
+typedef int64_t nsec_t;
+
+#ifndef NSEC_PER_SEC
+#define NSEC_PER_SEC 1000000000LL
+#endif
+#ifndef NSEC_PER_MSEC
+#define NSEC_PER_MSEC 1000000LL
+#endif
+
+static inline nsec_t timespec_to_ns(const struct timespec *ts)
+{
+	return (nsec_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/* Negative dates are clamped to 0 */
+static inline void ns_to_timespec(nsec_t ns, struct timespec *ts)
+{
+	if (ns < 0)
+		ns = 0;
+	ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+	ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+static inline nsec_t sec_to_ns(double sec)
+{
+	return (nsec_t)llround(sec * (double)NSEC_PER_SEC);
+}
+
+static inline double ns_to_sec(nsec_t ns)
+{
+	return (double)ns / (double)NSEC_PER_SEC;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "voice_allocator.h"
+#include <math.h>
+
+static int key2freq(int key)
+{
+	double freq = pow(2.0, ((double)key - 69.0) / 12.0) * 440.0;
+	return (int)round(freq);
+}
+
+static int loud2ratio(int loud)
+{
+	return loud * 2;
+}
+
+VoiceAllocator::VoiceAllocator(int channels, Policy policy) :
+	mPolicy(policy),
+	mVoices(channels),
+	mNotes(0),
+	mStolen(0),
+	mDropped(0)
+{
+}
+
+/* Free channel for a new voice, or channel to steal, or -1 */
+int VoiceAllocator::findVoice(const ChannelState& state)
+{
+	int found = -1;
+
+	for (size_t i = 0; i < mVoices.size(); i++) {
+		if (!mVoices[i].busy)
+			return (int)i;
+	}
+
+	for (size_t i = 0; i < mVoices.size(); i++) {
+		const Voice& voice(mVoices[i]);
+		const Voice *best = found < 0 ? NULL : &mVoices[found];
+		switch (mPolicy) {
+		case STEAL_NONE:
+			return -1;
+		case STEAL_OLDEST:
+			if (!best || voice.start < best->start)
+				found = (int)i;
+			break;
+		case STEAL_QUIETEST:
+			if (!best || voice.state.ratio < best->state.ratio ||
+			    (voice.state.ratio == best->state.ratio &&
+			     voice.start < best->start))
+				found = (int)i;
+			break;
+		case STEAL_LCHANNEL:
+			if (voice.state.lchannel == state.lchannel)
+				return (int)i;
+			break;
+		}
+	}
+	return found;
+}
+
+void VoiceAllocator::noteOn(nsec_t date, Alg_event_ptr evt,
+		std::vector<VoiceCommand>& commands)
+{
+	VoiceCommand cmd;
+	ChannelState state;
+	int key = evt->get_identifier();
+	int loud = (int)evt->get_loud();
+	int idx;
+
+	if (key > 127) key = 127;
+	if (key < 0) key = 0;
+	if (loud > 127) loud = 127;
+	if (loud <= 0)
+		return;
+
+	mNotes++;
+	state.busy = true;
+	state.lchannel = evt->chan & 15;
+	state.freq = key2freq(key);
+	state.ratio = loud2ratio(loud);
+
+	idx = findVoice(state);
+	if (idx < 0) {
+		mDropped++;
+		return;
+	}
+
+	Voice& voice(mVoices[idx]);
+	if (voice.busy) {
+		mStolen++;
+		cmd.date = date;
+		cmd.type = VoiceCommand::STOP;
+		cmd.channel = idx;
+		cmd.state = voice.state;
+		commands.push_back(cmd);
+	}
+	voice.busy = true;
+	voice.note = evt;
+	voice.start = date;
+	voice.state = state;
+
+	cmd.date = date;
+	cmd.type = VoiceCommand::START;
+	cmd.channel = idx;
+	cmd.state = state;
+	commands.push_back(cmd);
+}
+
+void VoiceAllocator::noteOff(nsec_t date, Alg_event_ptr evt,
+		std::vector<VoiceCommand>& commands)
+{
+	/* Nothing to do for a dropped or stolen note */
+	for (size_t i = 0; i < mVoices.size(); i++) {
+		Voice& voice(mVoices[i]);
+		if (!voice.busy || voice.note != evt)
+			continue;
+		VoiceCommand cmd;
+		cmd.date = date;
+		cmd.type = VoiceCommand::STOP;
+		cmd.channel = (int)i;
+		cmd.state = voice.state;
+		commands.push_back(cmd);
+		voice.busy = false;
+		voice.note = NULL;
+		return;
+	}
+}
+
+void VoiceAllocator::build(Alg_seq& seq, std::vector<VoiceCommand>& commands)
+{
+	for (auto it = mVoices.begin(); it != mVoices.end(); ++it) {
+		it->busy = false;
+		it->note = NULL;
+	}
+
+	Alg_iterator iterator(&seq, true);
+	iterator.begin();
+	bool note_on;
+	for (Alg_event_ptr e = iterator.next(&note_on); e;
+			e = iterator.next(&note_on)) {
+		if (!e->is_note())
+			continue;
+		if (note_on)
+			noteOn(sec_to_ns(e->time), e, commands);
+		else
+			noteOff(sec_to_ns(e->get_end_time()), e, commands);
+	}
+	iterator.end();
+}
+
+unsigned int VoiceAllocator::notes()
+{
+	return mNotes;
+}
+
+unsigned int VoiceAllocator::stolen()
+{
+	return mStolen;
+}
+
+unsigned int VoiceAllocator::dropped()
+{
+	return mDropped;
+}
@@ -0,0 +1,68 @@
+#ifndef VOICE_ALLOCATOR_H_INCLUDED
+#define VOICE_ALLOCATOR_H_INCLUDED
+
+#include <vector>
+#include <allegro.h>
+#include "timeline.h"
+#include "driver.h"
+
+/* Driver call resolved ahead of time */
+struct VoiceCommand
+{
+	enum Type {
+		START, // setChannelState(channel, state)
+		STOP,  // releaseChannel(channel)
+	};
+
+	nsec_t date;
+	Type type;
+	int channel;
+	ChannelState state;
+};
+
+/* Offline pass assigning every note of a sequence to a physical channel,
+ * before playback starts. When all the channels are busy, the policy
+ * tells which voice gives way to the new note, if any. */
+class VoiceAllocator
+{
+public:
+	enum Policy {
+		/* Drop the new note */
+		STEAL_NONE,
+		/* Stop the voice which started first */
+		STEAL_OLDEST,
+		/* Stop the softest voice, the oldest one among equals */
+		STEAL_QUIETEST,
+		/* Replace a voice of the same logical channel, drop the new
+		 * note if there is none */
+		STEAL_LCHANNEL,
+	};
+
+	VoiceAllocator(int channels, Policy policy);
+	/* Commands are appended in date order */
+	void build(Alg_seq& seq, std::vector<VoiceCommand>& commands);
+	unsigned int notes();
+	unsigned int stolen();
+	unsigned int dropped();
+private:
+	struct Voice {
+		bool busy;
+		Alg_event_ptr note;
+		nsec_t start;
+		ChannelState state;
+	};
+
+	int findVoice(const ChannelState& state);
+	void noteOn(nsec_t date, Alg_event_ptr evt,
+			std::vector<VoiceCommand>& commands);
+	void noteOff(nsec_t date, Alg_event_ptr evt,
+			std::vector<VoiceCommand>& commands);
+
+	Policy mPolicy;
+	std::vector<Voice> mVoices;
+	unsigned int mNotes;
+	unsigned int mStolen;
+	unsigned int mDropped;
+};
+
+#endif
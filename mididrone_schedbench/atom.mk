@@ -0,0 +1,17 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_schedbench
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Measure the cost of the musician's scheduler with virtual and direct driver calls, and the writes of the sysfs PWM driver
+LOCAL_SRC_FILES := \
+	mididrone_schedbench.cpp \
+	../mididrone_musician/scheduler.cpp \
+	../mididrone_musician/score.cpp \
+	../mididrone_musician/sysfs_pwm_driver.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../mididrone_musician
+LOCAL_LIBRARIES := portsmf libmididrone_trace
+LOCAL_CXXFLAGS := -std=c++0x
+
+include $(BUILD_EXECUTABLE)
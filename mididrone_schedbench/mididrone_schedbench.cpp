@@ -0,0 +1,339 @@
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include "score.h"
+#include "scheduler.h"
+#include "null_driver.h"
+#include "sysfs_pwm_driver.h"
+
+/* Channels of a drone, as many as its motors */
+#define DEFAULT_CHANNELS 4
+#define DEFAULT_RUNS 200
+
+struct opts {
+	bool ok;
+	unsigned int channels;
+	unsigned int runs;
+	const char* pwm_chip;
+	bool fake_chip;
+	const char* filename;
+};
+
+/* Scheduler built one way or the other, timed over whole passes */
+struct Path {
+	const char *name;
+	nsec_t best;
+	nsec_t total;
+	unsigned long calls;
+	unsigned long notes;
+};
+
+static nsec_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_ns(&ts);
+}
+
+#define NUM_FAKE_ATTRS 3
+static const char *fake_attrs[NUM_FAKE_ATTRS] = {
+	"period", "duty_cycle", "enable",
+};
+
+/* Path of channel chan of the fake chip, of its attribute attr if not
+ * NULL. Returns false when it does not fit. */
+static bool fake_path(char *path, const char *dir, unsigned int chan,
+		const char *attr)
+{
+	int len;
+
+	if (attr)
+		len = snprintf(path, PATH_MAX, "%s/pwm%u/%s", dir, chan, attr);
+	else
+		len = snprintf(path, PATH_MAX, "%s/pwm%u", dir, chan);
+	return len >= 0 && len < PATH_MAX;
+}
+
+/* Regular files where a PWM chip has its sysfs attributes, with its
+ * channels exported already */
+static bool make_fake_chip(char *dir, unsigned int channels)
+{
+	char path[PATH_MAX];
+	const char *tmp = getenv("TMPDIR");
+	FILE *f;
+
+	snprintf(dir, PATH_MAX, "%s/mididrone_pwmchip.XXXXXX",
+			tmp ? tmp : "/tmp");
+	if (!mkdtemp(dir)) {
+		printf("mkdtemp() failed: %s\n", strerror(errno));
+		return false;
+	}
+	for (unsigned int i = 0; i < channels; i++) {
+		if (!fake_path(path, dir, i, NULL) || mkdir(path, 0755) == -1) {
+			printf("Cannot create channel %u of %s\n", i, dir);
+			return false;
+		}
+		for (unsigned int j = 0; j < NUM_FAKE_ATTRS; j++) {
+			f = fake_path(path, dir, i, fake_attrs[j]) ?
+				fopen(path, "w") : NULL;
+			if (!f || fputs("0\n", f) == EOF) {
+				printf("Cannot create %s of channel %u of %s\n",
+						fake_attrs[j], i, dir);
+				if (f)
+					fclose(f);
+				return false;
+			}
+			fclose(f);
+		}
+	}
+	return true;
+}
+
+static void remove_fake_chip(const char *dir, unsigned int channels)
+{
+	char path[PATH_MAX];
+
+	for (unsigned int i = 0; i < channels; i++) {
+		for (unsigned int j = 0; j < NUM_FAKE_ATTRS; j++) {
+			if (fake_path(path, dir, i, fake_attrs[j]))
+				unlink(path);
+		}
+		if (fake_path(path, dir, i, NULL))
+			rmdir(path);
+	}
+	rmdir(dir);
+}
+
+/* Play the whole score as fast as possible, as mididrone_musician -F */
+static void run(Path& path, Scheduler& scheduler)
+{
+	nsec_t ts = 0;
+	nsec_t start = monotonic_ns();
+
+	scheduler.start();
+	while (ts >= 0)
+		ts = scheduler.process(ts);
+	nsec_t elapsed = monotonic_ns() - start;
+
+	if (path.best == 0 || elapsed < path.best)
+		path.best = elapsed;
+	path.total += elapsed;
+	path.calls = scheduler.stats().driverCalls;
+	path.notes = scheduler.stats().events - scheduler.stats().refused;
+}
+
+static void run_virtual(Path& path, const Score& score, int channels)
+{
+	NullDriver driver(channels);
+	DynamicScheduler scheduler(score, &driver);
+	run(path, scheduler);
+}
+
+static void run_direct(Path& path, const Score& score, int channels)
+{
+	NullDriver driver(channels);
+	DriverScheduler<NullDriver> scheduler(score, &driver);
+	run(path, scheduler);
+}
+
+static void print_path(const Path& path, unsigned int runs)
+{
+	double calls = path.calls ? (double)path.calls : 1.0;
+
+	printf("%-8s %10.3f %10.3f %12.1f %8lu\n", path.name,
+			(double)path.best / NSEC_PER_MSEC,
+			(double)path.total / runs / NSEC_PER_MSEC,
+			(double)path.best / calls, path.notes);
+}
+
+/* The same driver all along: values already set are not written again */
+static void run_sysfs(Path& path, const Score& score, SysfsPwmDriver& driver,
+		bool arm)
+{
+	DriverScheduler<SysfsPwmDriver> scheduler(score, &driver);
+	scheduler.setArming(arm);
+	driver.panic();
+	run(path, scheduler);
+}
+
+static int bench_sysfs(const struct opts& opts, const Score& score)
+{
+	char dir[PATH_MAX];
+	const char *chip = opts.pwm_chip;
+	unsigned long errors = 0;
+
+	if (opts.fake_chip) {
+		if (!make_fake_chip(dir, opts.channels)) {
+			remove_fake_chip(dir, opts.channels);
+			return -1;
+		}
+		chip = dir;
+	}
+
+	Path paths[] = {
+		{ "sysfs", 0, 0, 0, 0 },
+		{ "armed", 0, 0, 0, 0 },
+	};
+	printf("\nSysfs PWM driver on %s%s:\n", chip,
+			opts.fake_chip ? " (fake tree)" : "");
+	printf("%-8s %10s %10s %12s %8s\n", "PATH", "BEST_MS", "MEAN_MS",
+			"NS/CALL", "NOTES");
+	for (unsigned int i = 0; i < 2; i++) {
+		SysfsPwmDriver driver(chip, (int)opts.channels);
+		for (unsigned int j = 0; j < opts.runs; j++)
+			run_sysfs(paths[i], score, driver, i == 1);
+		errors += driver.errors();
+		print_path(paths[i], opts.runs);
+		/* Its write counts are reported when it goes */
+	}
+
+	if (opts.fake_chip)
+		remove_fake_chip(dir, opts.channels);
+	return errors ? -1 : 0;
+}
+
+static void usage(char* arg0)
+{
+	printf("Usage: %s [-c N] [-n RUNS] [-y CHIP | -Y] MIDIFILE\n",
+			basename(arg0));
+	printf("Play MIDIFILE as fast as possible through the musician's\n");
+	printf("scheduler, making the driver calls through the Driver\n");
+	printf("interface (virtual) or on the driver class (direct), and\n");
+	printf("compare the time per driver call. The driver only keeps\n");
+	printf("track of its channels.\n");
+	printf("  -h      Show this usage screen and exit\n");
+	printf("  -c N    Driver channels (default: %d)\n", DEFAULT_CHANNELS);
+	printf("  -n RUNS Passes over the score per path (default: %d)\n",
+			DEFAULT_RUNS);
+	printf("  -y CHIP Then play it on the sysfs PWM driver of CHIP,\n");
+	printf("          e.g. /sys/class/pwm/pwmchip0, without and with\n");
+	printf("          arming, and report its writes per note\n");
+	printf("  -Y      Same on a fake chip, regular files in a temporary\n");
+	printf("          directory\n");
+}
+
+static bool parse_uint(const char* str, unsigned int max, unsigned int* val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return false;
+	*val = (unsigned int)res;
+	return true;
+}
+
+static struct opts parse_opts(int argc, char* argv[])
+{
+	struct opts opts = {
+		.ok = false,
+		.channels = DEFAULT_CHANNELS,
+		.runs = DEFAULT_RUNS,
+		.pwm_chip = nullptr,
+		.fake_chip = false,
+		.filename = nullptr,
+	};
+	int opt = -1;
+	unsigned int val;
+
+	while((opt = getopt(argc, argv, ":c:hn:y:Y")) != -1) {
+		switch(opt) {
+		case 'c':
+			if (!parse_uint(optarg, 64, &val) || val == 0) {
+				printf("Invalid value for -c: %s\n", optarg);
+				return opts;
+			}
+			opts.channels = val;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'n':
+			if (!parse_uint(optarg, 1000000, &val) || val == 0) {
+				printf("Invalid value for -n: %s\n", optarg);
+				return opts;
+			}
+			opts.runs = val;
+			break;
+		case 'y':
+			opts.pwm_chip = optarg;
+			break;
+		case 'Y':
+			opts.fake_chip = true;
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if (opts.pwm_chip && opts.fake_chip) {
+		printf("-y and -Y are exclusive\n");
+		return opts;
+	}
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		return opts;
+	}
+
+	opts.filename = argv[optind];
+	opts.ok = true;
+	return opts;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
+		return 1;
+
+	Score score;
+	score.load(opts.filename);
+	if (score.size() == 0) {
+		printf("%s: no notes\n", opts.filename);
+		return EXIT_FAILURE;
+	}
+
+	Path paths[] = {
+		{ "virtual", 0, 0, 0, 0 },
+		{ "direct", 0, 0, 0, 0 },
+	};
+	/* Warm the caches, then alternate the paths so that frequency
+	 * scaling and other noise weigh on both alike */
+	run_virtual(paths[0], score, (int)opts.channels);
+	run_direct(paths[1], score, (int)opts.channels);
+	paths[0].best = paths[0].total = 0;
+	paths[1].best = paths[1].total = 0;
+	for (unsigned int i = 0; i < opts.runs; i++) {
+		run_virtual(paths[0], score, (int)opts.channels);
+		run_direct(paths[1], score, (int)opts.channels);
+	}
+
+	printf("%s: %zu notes, %u channels, %u passes\n\n", opts.filename,
+			score.size(), opts.channels, opts.runs);
+	printf("%-8s %10s %10s %12s %8s\n", "PATH", "BEST_MS", "MEAN_MS",
+			"NS/CALL", "NOTES");
+	print_path(paths[0], opts.runs);
+	print_path(paths[1], opts.runs);
+	printf("\nDirect calls: %+.1f%% time per driver call\n",
+			100.0 * ((double)paths[1].best - (double)paths[0].best) /
+			(double)paths[0].best);
+
+	if ((opts.pwm_chip || opts.fake_chip) && bench_sysfs(opts, score))
+		return EXIT_FAILURE;
+	return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef NULL_DRIVER_H_INCLUDED
+#define NULL_DRIVER_H_INCLUDED
+
+#include "driver.h"
+
+/* Channel bookkeeping of the stdout driver, without the output. Defined
+ * here so that a scheduler knowing the class can inline its calls. */
+class NullDriver final : public Driver
+{
+public:
+	NullDriver(int channels) : mNumChans(channels),
+		mChans(new ChannelState[channels])
+	{
+		panic();
+	}
+
+	virtual ~NullDriver()
+	{
+		delete[] mChans;
+	}
+
+	virtual int channels()
+	{
+		return mNumChans;
+	}
+
+	virtual ChannelState channelState(int idx)
+	{
+		return mChans[idx];
+	}
+
+	virtual bool addNote(nsec_t ts, nsec_t starttime, int lchannel,
+			int freq, int ratio, nsec_t duration)
+	{
+		update(ts);
+		for (int i = 0; i < mNumChans; ++i) {
+			ChannelState& chan(mChans[i]);
+			if (chan.busy)
+				continue;
+			chan.busy = true;
+			chan.freq = freq;
+			chan.ratio = ratio;
+			chan.lchannel = lchannel;
+			chan.stoptime = starttime + duration;
+			return true;
+		}
+		return false;
+	}
+
+	virtual void update(nsec_t ts)
+	{
+		for (int i = 0; i < mNumChans; ++i) {
+			if (mChans[i].busy && mChans[i].stoptime <= ts)
+				releaseChannel(i);
+		}
+	}
+
+	virtual nsec_t nextEventTime()
+	{
+		nsec_t closest = -1;
+		for (int i = 0; i < mNumChans; ++i) {
+			ChannelState& chan(mChans[i]);
+			if (chan.busy && (closest < 0 || chan.stoptime < closest))
+				closest = chan.stoptime;
+		}
+		return closest;
+	}
+
+	virtual void releaseChannel(int idx)
+	{
+		mChans[idx].busy = false;
+		mChans[idx].lchannel = -1;
+	}
+
+	virtual bool releaseLChannel(int lchan)
+	{
+		bool success = false;
+		for (int i = 0; i < mNumChans; ++i) {
+			if (mChans[i].busy && mChans[i].lchannel == lchan) {
+				releaseChannel(i);
+				success = true;
+			}
+		}
+		return success;
+	}
+
+	virtual void panic()
+	{
+		for (int i = 0; i < mNumChans; ++i) {
+			releaseChannel(i);
+			mChans[i].freq = 0;
+			mChans[i].ratio = 0;
+		}
+	}
+private:
+	int mNumChans;
+	ChannelState *mChans;
+};
+
+#endif
@@ -6,10 +6,11 @@ LOCAL_CATEGORY_PATH := mididrone
 LOCAL_DESCRIPTION := Split a MIDI file into several other MIDI files, one per drone.
 LOCAL_SRC_FILES := \
 	musician.cpp \
+	note_arena.cpp \
 	dispatcher.cpp \
 	mididrone_splitter.cpp
 
-LOCAL_LIBRARIES := portsmf libpomp libfutils
+LOCAL_LIBRARIES := portsmf libpomp libfutils libmididrone_trace
 LOCAL_CFLAGS := -std=gnu99
 LOCAL_CXXFLAGS := -std=c++0x
 
@@ -1,4 +1,11 @@
 #include "dispatcher.hpp"
+#include <algorithm>
+
+void Dispatcher::printStorageStats()
+{
+	printf("Stored %zu notes in %zu arena blocks (%zu bytes).\n",
+			arena.notes(), arena.blockCount(), arena.bytes());
+}
 
 SimpleDispatcher::SimpleDispatcher(unsigned int max_notes) :
 	musicians(),
@@ -15,13 +22,18 @@ void SimpleDispatcher::playNote(const Alg_event_ptr evt)
 	if (!evt->is_note())
 		return;
 
+	dispatch(arena.copy(static_cast<Alg_note_ptr>(evt)));
+}
+
+void SimpleDispatcher::dispatch(const Alg_note_ptr note)
+{
 	for (auto it = musicians.begin(); it != musicians.end(); ++it) {
-		if ((*it).playNote(evt))
+		if ((*it).playNote(note))
 			return;
 	}
 	// Not enough musicians to play this note, spawn a new one.
 	Musician m(notes_per_musician);
-	m.playNote(evt);
+	m.playNote(note);
 	musicians.push_back(m);
 }
 
@@ -46,11 +58,12 @@ void SimpleDispatcher::finalize()
 		++idx;
 	}
 	printf("Created %u files.\n", idx);
+	printStorageStats();
 }
 
 ChannelDispatcher::ChannelDispatcher(unsigned int max_notes) :
 	SimpleDispatcher(max_notes),
-	full_seq(),
+	full_notes(),
 	final_musicians()
 {
 }
@@ -61,11 +74,12 @@ ChannelDispatcher::~ChannelDispatcher()
 
 void ChannelDispatcher::playNote(const Alg_event_ptr evt)
 {
-	if (evt->is_note()) {
-		Alg_note* note(new Alg_note(dynamic_cast<Alg_note*>(evt)));
-		full_seq.add_event(note, 0);
-	}
-	SimpleDispatcher::playNote(evt);
+	if (!evt->is_note())
+		return;
+
+	Alg_note_ptr note(arena.copy(static_cast<Alg_note_ptr>(evt)));
+	full_notes.push_back(note);
+	dispatch(note);
 }
 
 void ChannelDispatcher::stopNote(const Alg_event_ptr evt)
@@ -83,25 +97,39 @@ void ChannelDispatcher::finalize()
 	 * for the channel first. */
 	final_musicians.clear();
 	final_musicians.resize(num_musicians, Musician(notes_per_musician));
-	Alg_iterator seq_iter(&full_seq, true);
-	seq_iter.begin();
-	bool on;
-	for (Alg_event_ptr evt = seq_iter.next(&on);
-			evt;
-			evt = seq_iter.next(&on)) {
-		if (!evt->is_note())
-			continue;
-		if (on) {
-			final_note_on(dynamic_cast<Alg_note_ptr>(evt));
+	std::vector<NoteEvent> events;
+	sortedEvents(events);
+	for (auto it = events.begin(); it != events.end(); ++it) {
+		if (it->on) {
+			final_note_on(it->note);
 		} else {
-			final_note_off(dynamic_cast<Alg_note_ptr>(evt));
+			final_note_off(it->note);
 		}
 	}
-	seq_iter.end();
 	musicians = final_musicians;
 	SimpleDispatcher::finalize();
 }
 
+/* Note on and off events of all the notes, in the order an Alg_iterator
+ * would return them: a note off is due just before the end of the note, so
+ * that it comes before a note on at the same date. */
+void ChannelDispatcher::sortedEvents(std::vector<NoteEvent>& events)
+{
+	events.clear();
+	events.reserve(full_notes.size() * 2);
+	for (auto it = full_notes.begin(); it != full_notes.end(); ++it) {
+		Alg_note_ptr note(*it);
+		NoteEvent on = { note->time, true, note };
+		NoteEvent off = { note->get_end_time() - ALG_EPS, false, note };
+		events.push_back(on);
+		events.push_back(off);
+	}
+	std::stable_sort(events.begin(), events.end(),
+			[](const NoteEvent& a, const NoteEvent& b) {
+				return a.time < b.time;
+			});
+}
+
 void ChannelDispatcher::final_note_on(const Alg_note_ptr note)
 {
 	unsigned int chan = static_cast<unsigned int>(note->chan);
@@ -173,10 +201,8 @@ void PriorityChannelDispatcher::appendRule(unsigned int priority,
 	musicians.sort();
 }
 
-bool PriorityChannelDispatcher::playNoteByTheRules(const Alg_event_ptr evt)
+bool PriorityChannelDispatcher::playNoteByTheRules(const Alg_note_ptr note)
 {
-	Alg_note_ptr note(static_cast<Alg_note_ptr>(evt));
-
 	// Iterate in reverse order so we try musicians with the higher
 	// priority first.
 	for (auto it = musicians.rbegin(); it != musicians.rend(); ++it) {
@@ -184,21 +210,21 @@ bool PriorityChannelDispatcher::playNoteByTheRules(const Alg_event_ptr evt)
 			return false;
 
 		if (it->rule->channels.count((unsigned int)note->chan) != 0) {
-			if (it->musician.playNote(evt))
+			if (it->musician.playNote(note))
 				return true;
 		}
 	}
 	return false;
 }
 
-bool PriorityChannelDispatcher::playNoteFifo(const Alg_event_ptr evt)
+bool PriorityChannelDispatcher::playNoteFifo(const Alg_note_ptr note)
 {
 	// Iterate in normal order so that the musicians with the higher
 	// priority are less affected by the notes added in FIFO mode.
 	for (auto it = musicians.begin(); it != musicians.end(); ++it) {
 		if ((*it).rule && (*it).rule->exclusive)
 			continue;
-		if ((*it).musician.playNote(evt))
+		if ((*it).musician.playNote(note))
 			return true;
 	}
 	return false;
@@ -209,11 +235,12 @@ void PriorityChannelDispatcher::playNote(const Alg_event_ptr evt)
 	if (!evt->is_note())
 		return;
 
-	if (!playNoteByTheRules(evt) && !playNoteFifo(evt)) {
+	Alg_note_ptr note(arena.copy(static_cast<Alg_note_ptr>(evt)));
+	if (!playNoteByTheRules(note) && !playNoteFifo(note)) {
 		// Not enough musicians to play this note, spawn a new one.
 		musicians.push_front(RuledMusician(polyphony));
 		// Ugly hack to force the new musician to play the note
-		musicians.front().musician.playNote(evt);
+		musicians.front().musician.playNote(note);
 	}
 }
 
@@ -238,4 +265,5 @@ void PriorityChannelDispatcher::finalize()
 		++idx;
 	}
 	printf("Created %u files.\n", idx);
+	printStorageStats();
 }
@@ -8,6 +8,7 @@
 #include <memory>
 #include <allegro.h>
 #include "musician.hpp"
+#include "note_arena.hpp"
 
 class Dispatcher
 {
@@ -15,6 +16,11 @@ public:
 	virtual void playNote(const Alg_event_ptr evt) = 0;
 	virtual void stopNote(const Alg_event_ptr evt) = 0;
 	virtual void finalize() = 0;
+protected:
+	/* Copies of all the notes handed to musicians for this split */
+	NoteArena arena;
+
+	void printStorageStats();
 };
 
 class SimpleDispatcher : public Dispatcher
@@ -22,6 +28,8 @@ class SimpleDispatcher : public Dispatcher
 protected:
 	std::vector<Musician> musicians;
 	unsigned int notes_per_musician;
+
+	void dispatch(const Alg_note_ptr note);
 public:
 	SimpleDispatcher(unsigned int notes_per_musician);
 	virtual ~SimpleDispatcher();
@@ -41,9 +49,16 @@ public:
 	virtual void stopNote(const Alg_event_ptr evt);
 	virtual void finalize();
 protected:
-	Alg_seq full_seq;
+	struct NoteEvent {
+		double time;
+		bool on;
+		Alg_note_ptr note;
+	};
+
+	std::vector<Alg_note_ptr> full_notes;
 	std::vector<Musician> final_musicians;
 private:
+	void sortedEvents(std::vector<NoteEvent>& events);
 	void final_note_on(const Alg_note_ptr note);
 	void final_note_off(const Alg_note_ptr note);
 };
@@ -64,8 +79,8 @@ class PriorityChannelDispatcher : public Dispatcher
 		bool operator<(const RuledMusician& b);
 	};
 private:
-	bool playNoteByTheRules(const Alg_event_ptr evt);
-	bool playNoteFifo(const Alg_event_ptr evt);
+	bool playNoteByTheRules(const Alg_note_ptr note);
+	bool playNoteFifo(const Alg_note_ptr note);
 protected:
 	unsigned int polyphony;
 	std::list<RuledMusician> musicians;
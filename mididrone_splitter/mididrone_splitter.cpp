@@ -9,6 +9,7 @@
 #include <cstdio>
 #include <memory>
 #include <allegro.h>
+#include <probes.h>
 #include "dispatcher.hpp"
 
 #define ROUND(x) (int) ((x)+0.5)
@@ -90,10 +91,16 @@ static void split(Alg_seq &seq, Dispatcher& disp)
 			//        next_time, e->chan, e->key, (int) e->loud);
 			/*midi_note_on(driver, next_time, e->chan, e->get_identifier(),
 					(int) e->get_loud());*/
+			MIDIDRONE_PROBE2(play_note_start, e->chan,
+					(int)e->get_identifier());
 			disp.playNote(e);
+			MIDIDRONE_PROBE(play_note_done);
 		} else if (e->is_note()) { // must be a note off
 			/* midi_note_on(driver, next_time, e->chan, e->get_identifier(), 0); */
+			MIDIDRONE_PROBE2(stop_note_start, e->chan,
+					(int)e->get_identifier());
 			disp.stopNote(e);
+			MIDIDRONE_PROBE(stop_note_done);
 #if UPDATE
 		} else if (e->is_update()) { // process updates here
 			Alg_update_ptr u = (Alg_update_ptr) e; // coerce to proper type
@@ -104,7 +111,9 @@ static void split(Alg_seq &seq, Dispatcher& disp)
 		e = iterator.next(&note_on);
 	}
 	iterator.end();
+	MIDIDRONE_PROBE(finalize_start);
 	disp.finalize();
+	MIDIDRONE_PROBE(finalize_done);
 }
 
 static void usage(char* arg0)
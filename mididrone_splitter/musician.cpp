@@ -18,7 +18,7 @@ MusicianNoteState::MusicianNoteState() :
 }
 
 Musician::Musician(unsigned int max) :
-	seq(new Alg_seq()),
+	notes(),
 	max_notes(max),
 	note_states(new MusicianNoteState[max])
 {
@@ -26,12 +26,11 @@ Musician::Musician(unsigned int max) :
 
 Musician::~Musician()
 {
-	delete seq;
 	delete[] note_states;
 }
 
 Musician::Musician(const Musician& mus) :
-	seq(new Alg_seq(mus.seq)),
+	notes(mus.notes),
 	max_notes(mus.max_notes),
 	note_states(new MusicianNoteState[mus.max_notes])
 {
@@ -43,8 +42,7 @@ Musician::Musician(const Musician& mus) :
 Musician& Musician::operator= (const Musician& mus)
 {
 	max_notes = mus.max_notes;
-	delete seq;
-	seq = new Alg_seq(mus.seq);
+	notes = mus.notes;
 	delete[] note_states;
 	note_states = new MusicianNoteState[mus.max_notes];
 	for (unsigned int i = 0; i < max_notes; i ++) {
@@ -68,13 +66,10 @@ unsigned int Musician::usedNotes()
 	return used;
 }
 
-bool Musician::playNote(const Alg_event_ptr evt)
+bool Musician::playNote(const Alg_note_ptr note)
 {
 	if (usedNotes() >= max_notes)
 		return false;
-	if (!evt->is_note()) {
-		throw "Event is not a note!\n";
-	}
 
 	unsigned int idx;
 	for (idx = 0; idx < max_notes; idx++) {
@@ -85,13 +80,12 @@ bool Musician::playNote(const Alg_event_ptr evt)
 	if (idx >= max_notes)
 		return false;
 
-	Alg_note_ptr note(dynamic_cast<Alg_note_ptr>(evt));
 	MusicianNoteState& state(note_states[idx]);
 	state.busy = true;
 	state.note = note->get_identifier();
 	state.channel = note->chan;
 
-	seq->add_event(new Alg_note(*note), 0);
+	notes.push_back(note);
 
 	return true;
 }
@@ -123,6 +117,18 @@ bool Musician::stopNote(const Alg_event_ptr evt)
 
 bool Musician::writeToFile(const char* filename)
 {
-	return seq->smf_write(filename);
+	Alg_seq seq;
+	bool res;
+
+	for (auto it = notes.begin(); it != notes.end(); ++it)
+		seq.add_event(*it, 0);
+	res = seq.smf_write(filename);
+
+	/* The sequence frees its events, but these belong to the arena:
+	 * detach them first. Writing converted their times to beats, nothing
+	 * reads them after this. */
+	for (int i = 0; i < seq.tracks(); i++)
+		seq.track(i)->set_events(NULL, 0, 0);
+	return res;
 }
 
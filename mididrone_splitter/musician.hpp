@@ -2,13 +2,16 @@
 #define MUSICIAN_H
 
 #include <cstring>
+#include <vector>
 #include <allegro.h>
 
 struct MusicianNoteState;
+/* Notes are referenced, not copied: they must outlive the musician, e.g.
+ * in the dispatcher's NoteArena. */
 class Musician
 {
 private:
-	Alg_seq *seq;
+	std::vector<Alg_note_ptr> notes;
 	unsigned int max_notes;
 	struct MusicianNoteState *note_states;
 public:
@@ -18,7 +21,7 @@ public:
 	~Musician();
 	unsigned int maxNotes();
 	unsigned int usedNotes();
-	bool playNote(const Alg_event_ptr evt);
+	bool playNote(const Alg_note_ptr note);
 	bool stopNote(const Alg_event_ptr evt);
 	bool writeToFile(const char* filename);
 };
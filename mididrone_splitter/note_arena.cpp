@@ -0,0 +1,49 @@
+#include "note_arena.hpp"
+#include <new>
+
+NoteArena::NoteArena(size_t block_notes) :
+	block_notes(block_notes),
+	used(block_notes),
+	count(0),
+	blocks()
+{
+}
+
+NoteArena::~NoteArena()
+{
+	for (size_t i = 0; i < blocks.size(); i ++) {
+		size_t constructed = (i + 1 == blocks.size()) ?
+			used : block_notes;
+		for (size_t j = 0; j < constructed; j ++)
+			blocks[i][j].~Alg_note();
+		operator delete(blocks[i]);
+	}
+}
+
+Alg_note_ptr NoteArena::copy(const Alg_note_ptr note)
+{
+	if (used == block_notes) {
+		void *block = operator new(block_notes * sizeof(Alg_note));
+		blocks.push_back(static_cast<Alg_note*>(block));
+		used = 0;
+	}
+	Alg_note_ptr copy = new (&blocks.back()[used]) Alg_note(note);
+	used++;
+	count++;
+	return copy;
+}
+
+size_t NoteArena::notes()
+{
+	return count;
+}
+
+size_t NoteArena::blockCount()
+{
+	return blocks.size();
+}
+
+size_t NoteArena::bytes()
+{
+	return blocks.size() * block_notes * sizeof(Alg_note);
+}
@@ -0,0 +1,29 @@
+#ifndef NOTE_ARENA_H
+#define NOTE_ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <allegro.h>
+
+/* Storage for the note copies made while splitting a sequence. Notes are
+ * constructed in large blocks and all destroyed at once with the arena,
+ * instead of being allocated and freed one by one. */
+class NoteArena
+{
+private:
+	size_t block_notes;
+	size_t used;
+	size_t count;
+	std::vector<Alg_note*> blocks;
+public:
+	NoteArena(size_t block_notes = 4096);
+	NoteArena(const NoteArena&) = delete;
+	NoteArena& operator= (const NoteArena&) = delete;
+	~NoteArena();
+	Alg_note_ptr copy(const Alg_note_ptr note);
+	size_t notes();
+	size_t blockCount();
+	size_t bytes();
+};
+
+#endif
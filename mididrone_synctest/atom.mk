@@ -0,0 +1,13 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_synctest
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Measure the onset skew between several musicians playing on localhost.
+LOCAL_SRC_FILES := \
+	mididrone_synctest.cpp
+
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_CXXFLAGS := -std=c++0x
+
+include $(BUILD_EXECUTABLE)
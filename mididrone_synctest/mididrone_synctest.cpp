@@ -0,0 +1,542 @@
+#include <math.h>
+#include <poll.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* Loopback synchronization test: one conductor, N musicians on localhost.
+ * The conductor sends to a relay socket owned by this program, which
+ * forwards every packet to each musician's own port, optionally dropping
+ * or delaying it. Status reports of the musicians go back to the
+ * conductor untouched. Each musician logs its onsets (-O), and the onsets
+ * of the same score position are compared across musicians. */
+
+#define DEFAULT_MUSICIANS 4
+#define DEFAULT_BASE_PORT 15555
+#define DEFAULT_TIMEOUT_SEC 600
+#define STARTUP_DELAY_US 500000
+#define MAX_PACKET_SIZE 64
+
+static sig_atomic_t quit = false;
+
+struct opts {
+	bool ok;
+	unsigned int musicians;
+	unsigned int base_port;
+	unsigned int loss_pct;
+	unsigned int delay_ms;
+	unsigned int jitter_ms;
+	unsigned int seed;
+	unsigned int timeout_sec;
+	unsigned int start_delay;
+	const char* conductor;
+	const char* musician;
+	const char* outdir;
+	std::vector<const char*> files;
+};
+
+struct delayed_packet {
+	unsigned int musician;
+	size_t size;
+	char payload[MAX_PACKET_SIZE];
+};
+
+struct onset {
+	long long mono_ns;
+	long long starttime_us;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(char* arg0)
+{
+	printf("Usage: %s [OPTIONS] MIDIFILE [MIDIFILE ...]\n", basename(arg0));
+	printf("Start one mididrone_conductor and N mididrone_musicians on\n");
+	printf("localhost and measure the onset skew between musicians.\n");
+	printf("Musician i plays MIDIFILE number (i modulo the number of\n");
+	printf("files).\n");
+	printf("  -h       Show this usage screen and exit\n");
+	printf("  -n N     Number of musicians (default: %d)\n",
+			DEFAULT_MUSICIANS);
+	printf("  -l PCT   Drop PCT%% of the conductor packets (default: 0)\n");
+	printf("  -d MS    Delay conductor packets by MS milliseconds\n");
+	printf("  -j MS    Add up to MS milliseconds of random delay\n");
+	printf("  -r SEED  Random seed for loss and jitter (default: 1)\n");
+	printf("  -p PORT  Relay port, musicians use the next N ports\n");
+	printf("           (default: %d)\n", DEFAULT_BASE_PORT);
+	printf("  -t SEC   Give up after SEC seconds (default: %d)\n",
+			DEFAULT_TIMEOUT_SEC);
+	printf("  -S SEC   Let the conductor announce the start SEC seconds\n");
+	printf("           in advance (default: 0, immediate start)\n");
+	printf("  -c PATH  mididrone_conductor binary\n");
+	printf("  -m PATH  mididrone_musician binary\n");
+	printf("  -o DIR   Directory for onset files and logs (default: .)\n");
+}
+
+static bool parse_uint(const char* str, unsigned int max, unsigned int* val)
+{
+	char *endptr = NULL;
+	long int res = strtol(str, &endptr, 0);
+	if (endptr == str || *endptr || res < 0 || res > (long int)max)
+		return false;
+	*val = (unsigned int)res;
+	return true;
+}
+
+static struct opts parse_opts(int argc, char* argv[])
+{
+	struct opts opts;
+	int opt = -1;
+
+	opts.ok = false;
+	opts.musicians = DEFAULT_MUSICIANS;
+	opts.base_port = DEFAULT_BASE_PORT;
+	opts.loss_pct = 0;
+	opts.delay_ms = 0;
+	opts.jitter_ms = 0;
+	opts.seed = 1;
+	opts.timeout_sec = DEFAULT_TIMEOUT_SEC;
+	opts.start_delay = 0;
+	opts.conductor = "mididrone_conductor";
+	opts.musician = "mididrone_musician";
+	opts.outdir = ".";
+
+	while((opt = getopt(argc, argv, ":c:d:hj:l:m:n:o:p:r:S:t:")) != -1) {
+		switch(opt) {
+		case 'c':
+			opts.conductor = optarg;
+			break;
+		case 'd':
+			if (!parse_uint(optarg, 60000, &opts.delay_ms)) {
+				printf("Invalid value for -d: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return opts;
+		case 'j':
+			if (!parse_uint(optarg, 60000, &opts.jitter_ms)) {
+				printf("Invalid value for -j: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'l':
+			if (!parse_uint(optarg, 100, &opts.loss_pct)) {
+				printf("Invalid value for -l: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'm':
+			opts.musician = optarg;
+			break;
+		case 'n':
+			if (!parse_uint(optarg, 1000, &opts.musicians) ||
+			    opts.musicians == 0) {
+				printf("Invalid value for -n: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'o':
+			opts.outdir = optarg;
+			break;
+		case 'p':
+			if (!parse_uint(optarg, 65535, &opts.base_port) ||
+			    opts.base_port == 0) {
+				printf("Invalid value for -p: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'r':
+			if (!parse_uint(optarg, UINT_MAX, &opts.seed)) {
+				printf("Invalid value for -r: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 'S':
+			if (!parse_uint(optarg, 3600, &opts.start_delay)) {
+				printf("Invalid value for -S: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case 't':
+			if (!parse_uint(optarg, 86400, &opts.timeout_sec)) {
+				printf("Invalid value for -t: %s\n", optarg);
+				return opts;
+			}
+			break;
+		case '?':
+			printf("Unknown option: %s\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		case ':':
+			printf("Option %s expects an argument.\n", argv[optind - 1]);
+			usage(argv[0]);
+			return opts;
+		default:
+			printf("Unexpected option: %d\n", opt);
+			return opts;
+		}
+	}
+
+	if (argc - optind == 0) {
+		printf("Expected MIDI file.\n");
+		usage(argv[0]);
+		return opts;
+	}
+	if (opts.base_port + opts.musicians > 65535) {
+		printf("Port range exceeds 65535.\n");
+		return opts;
+	}
+	for (int i = optind; i < argc; i++)
+		opts.files.push_back(argv[i]);
+
+	opts.ok = true;
+	return opts;
+}
+
+static std::string out_path(const struct opts& opts, const char* name,
+		unsigned int idx)
+{
+	char buf[PATH_MAX];
+	snprintf(buf, sizeof(buf), "%s/%s_%.2u.txt", opts.outdir, name, idx);
+	return buf;
+}
+
+/* fork() and exec() argv, with stdout and stderr going to logfile. */
+static pid_t spawn(std::vector<std::string>& args, const std::string& logfile)
+{
+	pid_t pid = fork();
+	if (pid == -1) {
+		printf("fork() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0) {
+		std::vector<char*> argv;
+		int fd = open(logfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+				0644);
+		if (fd != -1) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		for (auto it = args.begin(); it != args.end(); ++it)
+			argv.push_back(const_cast<char*>(it->c_str()));
+		argv.push_back(NULL);
+		execvp(argv[0], &argv[0]);
+		fprintf(stderr, "execvp(%s) failed: %s\n", argv[0],
+				strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+static int relay_setup(unsigned int port)
+{
+	int sock;
+	struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock == -1) {
+		printf("socket() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (bind(sock, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		printf("bind() failed: %s\n", strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static void relay_send(int sock, unsigned int port, const void *payload,
+		size_t size)
+{
+	struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sendto(sock, payload, size, 0,
+			(const struct sockaddr*)&addr, sizeof(addr)) == -1)
+		printf("sendto(%u) failed: %s\n", port, strerror(errno));
+}
+
+/* Forward conductor packets until all musicians exited, or timeout.
+ * Returns the number of musicians still running. */
+static unsigned int relay_loop(const struct opts& opts, int sock,
+		std::vector<pid_t>& musicians)
+{
+	std::multimap<long long, struct delayed_packet> pending;
+	unsigned int running = musicians.size();
+	unsigned long forwarded = 0, dropped = 0, reports = 0;
+	bool conductor_known = false;
+	struct sockaddr_in conductor;
+	long long deadline = now_ns() + opts.timeout_sec * 1000000000LL;
+
+	while (running > 0 && !quit && now_ns() < deadline) {
+		struct pollfd pfd;
+		int timeout = 100;
+		long long now = now_ns();
+
+		/* Send delayed packets that are due */
+		while (!pending.empty() && pending.begin()->first <= now) {
+			struct delayed_packet& pkt(pending.begin()->second);
+			relay_send(sock, opts.base_port + 1 + pkt.musician,
+					pkt.payload, pkt.size);
+			pending.erase(pending.begin());
+		}
+		if (!pending.empty()) {
+			long long wait_ms = (pending.begin()->first - now +
+					999999) / 1000000;
+			if (wait_ms < timeout)
+				timeout = (int)wait_ms;
+		}
+
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+			char payload[MAX_PACKET_SIZE];
+			struct sockaddr_in from = sockaddr_in();
+			socklen_t fromlen = sizeof(from);
+			ssize_t size = recvfrom(sock, payload, sizeof(payload),
+					0, (struct sockaddr*)&from, &fromlen);
+			unsigned int from_port = ntohs(from.sin_port);
+			if (size > 0 && from_port > opts.base_port &&
+			    from_port <= opts.base_port + musicians.size()) {
+				/* From a musician: a status report */
+				if (conductor_known && sendto(sock, payload,
+						(size_t)size, 0,
+						(const struct sockaddr*)&conductor,
+						sizeof(conductor)) != -1)
+					reports++;
+			} else if (size > 0) {
+				conductor = from;
+				conductor_known = true;
+				now = now_ns();
+				for (unsigned int i = 0; i < musicians.size();
+						i++) {
+					struct delayed_packet pkt;
+					long long delay;
+					if ((unsigned int)(rand() % 100) <
+							opts.loss_pct) {
+						dropped++;
+						continue;
+					}
+					delay = opts.delay_ms * 1000000LL;
+					if (opts.jitter_ms)
+						delay += (long long)(rand() %
+							(opts.jitter_ms * 1000))
+							* 1000LL;
+					pkt.musician = i;
+					pkt.size = (size_t)size;
+					memcpy(pkt.payload, payload, pkt.size);
+					pending.insert(std::make_pair(
+							now + delay, pkt));
+					forwarded++;
+				}
+			}
+		}
+
+		for (unsigned int i = 0; i < musicians.size(); i++) {
+			int status;
+			if (musicians[i] <= 0)
+				continue;
+			if (waitpid(musicians[i], &status, WNOHANG) ==
+					musicians[i]) {
+				musicians[i] = 0;
+				running--;
+			}
+		}
+	}
+	printf("Relay: %lu packets forwarded, %lu dropped, %lu status "
+			"reports\n", forwarded, dropped, reports);
+	return running;
+}
+
+static bool load_onsets(const std::string& path, std::vector<struct onset>& out)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	long sec, nsec;
+	double starttime;
+	int lchannel, freq;
+
+	if (!f)
+		return false;
+	while (fscanf(f, "%ld.%ld %lf %d %d", &sec, &nsec, &starttime,
+				&lchannel, &freq) == 5) {
+		struct onset o;
+		o.mono_ns = (long long)sec * 1000000000LL + nsec;
+		o.starttime_us = llround(starttime * 1000000.0);
+		out.push_back(o);
+	}
+	fclose(f);
+	return true;
+}
+
+static void report(const struct opts& opts)
+{
+	/* Score position -> earliest onset of each musician */
+	std::map<long long, std::map<unsigned int, long long> > positions;
+	std::vector<double> skews;
+	std::vector<double> deviation_sum(opts.musicians, 0.0);
+	std::vector<unsigned long> deviation_count(opts.musicians, 0);
+
+	for (unsigned int i = 0; i < opts.musicians; i++) {
+		std::vector<struct onset> onsets;
+		if (!load_onsets(out_path(opts, "onsets", i), onsets) ||
+		    onsets.empty()) {
+			printf("Musician %u: no onsets recorded\n", i);
+			continue;
+		}
+		for (auto it = onsets.begin(); it != onsets.end(); ++it) {
+			auto& slot = positions[it->starttime_us];
+			auto prev = slot.find(i);
+			if (prev == slot.end() || prev->second > it->mono_ns)
+				slot[i] = it->mono_ns;
+		}
+	}
+
+	for (auto it = positions.begin(); it != positions.end(); ++it) {
+		auto& slot(it->second);
+		long long min = LLONG_MAX, max = LLONG_MIN;
+		double mean = 0.0;
+		if (slot.size() < 2)
+			continue;
+		for (auto m = slot.begin(); m != slot.end(); ++m) {
+			min = std::min(min, m->second);
+			max = std::max(max, m->second);
+			mean += (double)m->second;
+		}
+		mean /= (double)slot.size();
+		for (auto m = slot.begin(); m != slot.end(); ++m) {
+			deviation_sum[m->first] += (double)m->second - mean;
+			deviation_count[m->first]++;
+		}
+		skews.push_back((double)(max - min) / 1000000.0);
+	}
+
+	if (skews.empty()) {
+		printf("No score position played by at least two musicians.\n");
+		return;
+	}
+
+	std::sort(skews.begin(), skews.end());
+	double sum = 0.0;
+	for (auto it = skews.begin(); it != skews.end(); ++it)
+		sum += *it;
+	size_t p99 = (size_t)ceil(0.99 * (double)skews.size()) - 1;
+
+	printf("Onset skew over %zu shared score positions (ms): "
+			"mean %.3f p99 %.3f max %.3f\n", skews.size(),
+			sum / (double)skews.size(), skews[p99], skews.back());
+	for (unsigned int i = 0; i < opts.musicians; i++) {
+		if (!deviation_count[i])
+			continue;
+		printf("  musician %.2u: mean offset from fleet %+.3f ms over "
+				"%lu positions\n", i,
+				deviation_sum[i] / deviation_count[i] / 1000000.0,
+				deviation_count[i]);
+	}
+}
+
+static void sig_handler(int sig)
+{
+	quit = true;
+}
+
+int main(int argc, char* argv[])
+{
+	auto opts = parse_opts(argc, argv);
+	if (!opts.ok)
+		return EXIT_FAILURE;
+
+	signal(SIGINT, sig_handler);
+	signal(SIGQUIT, sig_handler);
+	signal(SIGHUP, sig_handler);
+	srand(opts.seed);
+
+	int relay = relay_setup(opts.base_port);
+	if (relay == -1)
+		return EXIT_FAILURE;
+
+	std::vector<pid_t> musicians;
+	for (unsigned int i = 0; i < opts.musicians; i++) {
+		char port[16];
+		snprintf(port, sizeof(port), "%u", opts.base_port + 1 + i);
+		std::vector<std::string> args;
+		args.push_back(opts.musician);
+		args.push_back("-p");
+		args.push_back(port);
+		args.push_back("-O");
+		args.push_back(out_path(opts, "onsets", i));
+		args.push_back(opts.files[i % opts.files.size()]);
+		musicians.push_back(spawn(args, out_path(opts, "musician", i)));
+	}
+
+	/* Let the musicians bind their sockets before the go */
+	usleep(STARTUP_DELAY_US);
+
+	char port[16], delay[16];
+	snprintf(port, sizeof(port), "%u", opts.base_port);
+	snprintf(delay, sizeof(delay), "%u", opts.start_delay);
+	std::vector<std::string> args;
+	args.push_back(opts.conductor);
+	args.push_back("-p");
+	args.push_back(port);
+	args.push_back("-d");
+	args.push_back(delay);
+	args.push_back("127.0.0.1");
+	pid_t conductor = spawn(args, out_path(opts, "conductor", 0));
+
+	printf("Running %u musicians, loss %u%%, delay %u ms, jitter %u ms\n",
+			opts.musicians, opts.loss_pct, opts.delay_ms,
+			opts.jitter_ms);
+	unsigned int remaining = relay_loop(opts, relay, musicians);
+	if (remaining)
+		printf("%u musicians did not finish, killing them.\n",
+				remaining);
+
+	for (auto it = musicians.begin(); it != musicians.end(); ++it) {
+		if (*it > 0) {
+			kill(*it, SIGINT);
+			waitpid(*it, NULL, 0);
+		}
+	}
+	if (conductor > 0) {
+		kill(conductor, SIGTERM);
+		waitpid(conductor, NULL, 0);
+	}
+	close(relay);
+
+	report(opts);
+	return remaining ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := mididrone_trace
+LOCAL_CATEGORY_PATH := mididrone
+LOCAL_DESCRIPTION := Dump and compare driver call traces recorded by mididrone_musician or mididrone_player.
+LOCAL_SRC_FILES := \
+	mididrone_trace.c
+
+LOCAL_LIBRARIES := libmididrone_trace
+LOCAL_CFLAGS := -std=gnu99
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <trace.h>
+
+/* Mismatching records printed by diff */
+#define MAX_REPORTED 10
+
+struct trace {
+	struct trace_header header;
+	struct trace_record *records;
+	size_t count;
+};
+
+static void usage(char *arg0)
+{
+	printf("Usage: %s dump TRACE\n"
+	       "       %s diff [-t US] TRACE_A TRACE_B\n",
+	       basename(arg0), basename(arg0));
+	printf("  dump    Print the records of TRACE, one per line\n");
+	printf("  diff    Compare the calls of two traces, record by record,\n");
+	printf("          and their timing relative to the first record.\n");
+	printf("          Exits with 1 when the calls differ\n");
+	printf("  -t US   Also exit with 1 when a call moved by more than\n");
+	printf("          US microseconds\n");
+}
+
+static double ns_to_sec(int64_t ns)
+{
+	return (double)ns / 1000000000.0;
+}
+
+static int load(const char *path, struct trace *trace)
+{
+	struct trace_reader *reader;
+	struct trace_record record;
+	size_t capacity = 0;
+	int res;
+
+	memset(trace, 0, sizeof(*trace));
+	reader = trace_reader_new(path);
+	if (!reader)
+		return -1;
+	trace->header = *trace_reader_header(reader);
+	while ((res = trace_reader_next(reader, &record)) == 1) {
+		if (trace->count == capacity) {
+			struct trace_record *records;
+			capacity = capacity ? capacity * 2 : 1024;
+			records = realloc(trace->records,
+					capacity * sizeof(*records));
+			if (!records) {
+				printf("Out of memory\n");
+				res = -1;
+				break;
+			}
+			trace->records = records;
+		}
+		trace->records[trace->count++] = record;
+	}
+	trace_reader_destroy(reader);
+	if (res < 0) {
+		printf("Failed to read %s\n", path);
+		free(trace->records);
+		return -1;
+	}
+	return 0;
+}
+
+static const char *source_str(uint16_t source)
+{
+	switch (source) {
+	case TRACE_SOURCE_MUSICIAN: return "musician";
+	case TRACE_SOURCE_PLAYER: return "player";
+	default: return "unknown";
+	}
+}
+
+static void print_record(size_t idx, const struct trace_record *rec)
+{
+	printf("%6zu %12.6f %-16s", idx, ns_to_sec(rec->date),
+			trace_type_str(rec->type));
+	if (rec->ts >= 0)
+		printf(" ts=%.6f", ns_to_sec(rec->ts));
+	if (rec->channel >= 0)
+		printf(" chan=%d", rec->channel);
+	if (rec->lchannel >= 0)
+		printf(" lchan=%d", rec->lchannel);
+	if (rec->type == TRACE_ADD_NOTE || rec->type == TRACE_SET_CHANNEL ||
+	    rec->type == TRACE_SET_FIRST_FREE)
+		printf(" freq=%u ratio=%u", rec->freq, rec->ratio);
+	if (rec->type == TRACE_ADD_NOTE)
+		printf(" start=%.6f duration=%.6f", ns_to_sec(rec->starttime),
+				ns_to_sec(rec->duration));
+	printf(" -> %u\n", rec->result);
+}
+
+static int dump(const char *path)
+{
+	struct trace trace;
+	size_t i;
+
+	if (load(path, &trace))
+		return EXIT_FAILURE;
+	printf("# %s trace, %u channels, %zu records\n",
+			source_str(trace.header.source),
+			trace.header.channels, trace.count);
+	for (i = 0; i < trace.count; i++)
+		print_record(i, &trace.records[i]);
+	free(trace.records);
+	return EXIT_SUCCESS;
+}
+
+/* Same call with the same arguments, dates aside */
+static int same_call(const struct trace_record *a,
+		const struct trace_record *b)
+{
+	return a->type == b->type && a->ts == b->ts &&
+		a->starttime == b->starttime && a->duration == b->duration &&
+		a->freq == b->freq && a->channel == b->channel &&
+		a->lchannel == b->lchannel && a->ratio == b->ratio &&
+		a->result == b->result;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t va = *(const int64_t *)a;
+	int64_t vb = *(const int64_t *)b;
+	return va < vb ? -1 : va > vb;
+}
+
+static int diff(const char *path_a, const char *path_b, long threshold_us)
+{
+	struct trace a, b;
+	size_t i, count, mismatches = 0;
+	int64_t *shifts = NULL;
+	int64_t sum = 0;
+	int res = EXIT_SUCCESS;
+
+	if (load(path_a, &a))
+		return EXIT_FAILURE;
+	if (load(path_b, &b)) {
+		free(a.records);
+		return EXIT_FAILURE;
+	}
+	if (a.header.source != b.header.source)
+		printf("Traces come from a %s and a %s\n",
+				source_str(a.header.source),
+				source_str(b.header.source));
+
+	count = a.count < b.count ? a.count : b.count;
+	if (count > 0)
+		shifts = malloc(count * sizeof(*shifts));
+	if (count > 0 && !shifts) {
+		printf("Out of memory\n");
+		res = EXIT_FAILURE;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct trace_record *ra = &a.records[i];
+		const struct trace_record *rb = &b.records[i];
+		int64_t shift = (rb->date - b.records[0].date) -
+			(ra->date - a.records[0].date);
+		shifts[i] = llabs(shift);
+		sum += shift;
+		if (same_call(ra, rb))
+			continue;
+		if (mismatches++ < MAX_REPORTED) {
+			printf("< ");
+			print_record(i, ra);
+			printf("> ");
+			print_record(i, rb);
+		}
+	}
+
+	printf("%zu vs %zu records, %zu calls differ\n", a.count, b.count,
+			mismatches);
+	if (mismatches || a.count != b.count)
+		res = EXIT_FAILURE;
+	if (count > 0) {
+		qsort(shifts, count, sizeof(*shifts), cmp_int64);
+		printf("Timing shift of B vs A (us): mean %+.1f, |shift| "
+				"p50 %.1f p99 %.1f max %.1f\n",
+				(double)sum / (double)count / 1000.0,
+				(double)shifts[count / 2] / 1000.0,
+				(double)shifts[(99 * count + 99) / 100 - 1]
+					/ 1000.0,
+				(double)shifts[count - 1] / 1000.0);
+		if (threshold_us >= 0 &&
+		    shifts[count - 1] > (int64_t)threshold_us * 1000) {
+			printf("Max shift above %ld us\n", threshold_us);
+			res = EXIT_FAILURE;
+		}
+	}
+
+out:
+	free(shifts);
+	free(a.records);
+	free(b.records);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	long threshold_us = -1;
+	char *endptr = NULL;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(argv[1], "dump") == 0) {
+		if (argc != 3) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		return dump(argv[2]);
+	}
+
+	if (strcmp(argv[1], "diff") == 0) {
+		optind = 2;
+		while ((opt = getopt(argc, argv, "t:")) != -1) {
+			switch (opt) {
+			case 't':
+				threshold_us = strtol(optarg, &endptr, 0);
+				if (endptr == optarg || *endptr ||
+				    threshold_us < 0) {
+					printf("Invalid threshold: %s\n",
+							optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		if (argc - optind != 2) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		return diff(argv[optind], argv[optind + 1], threshold_us);
+	}
+
+	usage(argv[0]);
+	return EXIT_FAILURE;
+}